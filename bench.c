@@ -0,0 +1,619 @@
+/*
+ * Copyright (C) 2017  Alex Yatskov <alex@foosoft.net>
+ * Author: Alex Yatskov <alex@foosoft.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <time.h>
+
+#include "book_internal.h"
+#include "buffer.h"
+#include "convert.h"
+#include "emit.h"
+#include "parallel.h"
+#include "util.h"
+#include "writer.h"
+
+#include "jansson/include/jansson.h"
+
+/*
+ * Macros
+ */
+
+#ifdef _WIN32
+#define BENCH_NULL_DEVICE "NUL"
+#else
+#define BENCH_NULL_DEVICE "/dev/null"
+#endif
+
+#define BENCH_CONVERT_SIZE (1024 * 1024)
+#define BENCH_UNDUPE_SIZE 200000
+#define BENCH_ESCAPE_STRING_SIZE 4096
+
+/*
+ * Local types
+ */
+
+typedef void (*Bench_Func)(void* context);
+
+typedef struct Bench_Case {
+    const char* name;
+    Bench_Func  setup;
+    Bench_Func  run;
+    void*       context;
+    long long   bytes;
+} Bench_Case;
+
+typedef struct Bench {
+    json_t*     results;
+    const char* filter;
+    int         iterations;
+    int         threads;
+} Bench;
+
+typedef struct Bench_Convert {
+    char* input;
+    int   normalize;
+} Bench_Convert;
+
+typedef struct Bench_Escape {
+    char** strings;
+    int    string_count;
+    Buffer buffer;
+} Bench_Escape;
+
+typedef struct Bench_Undupe {
+    Book_Entry*  entries;
+    int          entry_count;
+    Book_Subbook subbook;
+} Bench_Undupe;
+
+typedef struct Bench_Export {
+    Book         book;
+    Book_Options options;
+    FILE*        fp;
+} Bench_Export;
+
+typedef struct Bench_Import {
+    const char*  path;
+    Book_Options options;
+    FILE*        fp;
+    int          success;
+} Bench_Import;
+
+/*
+ * Local functions
+ */
+
+static double bench_now() {
+    struct timespec time;
+    if (clock_gettime(CLOCK_MONOTONIC, &time) != 0) {
+        return 0.0;
+    }
+
+    return time.tv_sec + time.tv_nsec / 1e9;
+}
+
+static int bench_compare(const void* a, const void* b) {
+    const double x = *(const double*)a;
+    const double y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+static void bench_run(Bench* bench, const Bench_Case* bench_case) {
+    if (bench->filter != NULL && strstr(bench_case->name, bench->filter) == NULL) {
+        return;
+    }
+
+    double* samples = calloc(bench->iterations, sizeof(double));
+    double total = 0.0;
+
+    for (int i = 0; i < bench->iterations; ++i) {
+        if (bench_case->setup != NULL) {
+            bench_case->setup(bench_case->context);
+        }
+
+        const double start = bench_now();
+        bench_case->run(bench_case->context);
+        samples[i] = bench_now() - start;
+        total += samples[i];
+    }
+
+    qsort(samples, bench->iterations, sizeof(double), bench_compare);
+
+    const double median = samples[bench->iterations / 2];
+
+    json_t* result_json = json_object();
+    json_object_set_new(result_json, "name", json_string(bench_case->name));
+    json_object_set_new(result_json, "iterations", json_integer(bench->iterations));
+    json_object_set_new(result_json, "min", json_real(samples[0]));
+    json_object_set_new(result_json, "median", json_real(median));
+    json_object_set_new(result_json, "mean", json_real(total / bench->iterations));
+    json_object_set_new(result_json, "max", json_real(samples[bench->iterations - 1]));
+    if (bench_case->bytes > 0 && median > 0.0) {
+        json_object_set_new(result_json, "bytes", json_integer(bench_case->bytes));
+        json_object_set_new(result_json, "bytesPerSecond", json_real(bench_case->bytes / median));
+    }
+
+    json_array_append_new(bench->results, result_json);
+    fprintf(stderr, "%-32s median %.6fs\n", bench_case->name, median);
+
+    free(samples);
+}
+
+/*
+ * EUC-JP conversion
+ */
+
+static char* bench_convert_input(int kana_percent) {
+    char* input = malloc(BENCH_CONVERT_SIZE + 1);
+    unsigned seed = 1;
+
+    int size = 0;
+    while (size + 2 <= BENCH_CONVERT_SIZE) {
+        seed = seed * 1103515245 + 12345;
+        const unsigned roll = (seed >> 16) % 100;
+
+        if (roll < (unsigned)kana_percent) {
+            /* Hiragana row with the occasional first-level kanji. */
+            if ((seed >> 8) % 4 == 0) {
+                input[size++] = 0xb0 + (seed >> 4) % 31;
+                input[size++] = 0xa1 + (seed >> 12) % 94;
+            }
+            else {
+                input[size++] = 0xa4;
+                input[size++] = 0xa1 + (seed >> 12) % 83;
+            }
+        }
+        else {
+            input[size++] = 'a' + (seed >> 12) % 26;
+            input[size++] = (seed >> 8) % 6 == 0 ? ' ' : 'a' + (seed >> 4) % 26;
+        }
+    }
+
+    input[size] = 0;
+    return input;
+}
+
+static void bench_convert_run(void* context) {
+    const Bench_Convert* convert = context;
+    if (convert->normalize) {
+        char* text = NULL;
+        char* normalized = NULL;
+        eucjp_to_utf8_normalized(convert->input, &text, &normalized);
+        free(text);
+        free(normalized);
+    }
+    else {
+        free(eucjp_to_utf8(convert->input));
+    }
+}
+
+static void bench_convert(Bench* bench) {
+    const struct {
+        const char* name;
+        int         kana_percent;
+        int         normalize;
+    } inputs[] = {
+        { "convert/ascii",            0,   0 },
+        { "convert/kana",             100, 0 },
+        { "convert/mixed",            50,  0 },
+        { "convert/mixed-normalized", 50,  1 },
+    };
+
+    for (unsigned i = 0; i < ARRSIZE(inputs); ++i) {
+        Bench_Convert convert = {};
+        convert.input = bench_convert_input(inputs[i].kana_percent);
+        convert.normalize = inputs[i].normalize;
+
+        Bench_Case bench_case = {};
+        bench_case.name = inputs[i].name;
+        bench_case.run = bench_convert_run;
+        bench_case.context = &convert;
+        bench_case.bytes = strlen(convert.input);
+        bench_run(bench, &bench_case);
+
+        free(convert.input);
+    }
+}
+
+/*
+ * JSON string emission
+ */
+
+static void bench_escape_kernel_run(void* context) {
+    Bench_Escape* escape = context;
+    for (int i = 0; i < escape->string_count; ++i) {
+        const char* text = escape->strings[i];
+        const size_t size = strlen(text);
+
+        buffer_clear(&escape->buffer);
+        if (emit_utf8_check(text, size)) {
+            emit_string(&escape->buffer, text, size);
+        }
+    }
+}
+
+static void bench_escape_jansson_run(void* context) {
+    Bench_Escape* escape = context;
+    for (int i = 0; i < escape->string_count; ++i) {
+        json_t* string_json = json_string(escape->strings[i]);
+        if (string_json != NULL) {
+            free(json_dumps(string_json, JSON_ENCODE_ANY));
+            json_decref(string_json);
+        }
+    }
+}
+
+/* Checks that the emit kernel accepts, rejects and escapes exactly like jansson. */
+static int bench_escape_verify(Bench_Escape* escape) {
+    int success = 1;
+    for (int i = 0; i < escape->string_count; ++i) {
+        const char* text = escape->strings[i];
+        const size_t size = strlen(text);
+
+        json_t* string_json = json_string(text);
+        if ((string_json != NULL) != emit_utf8_check(text, size)) {
+            fprintf(stderr, "error: UTF-8 validation differs from jansson for string %d\n", i);
+            success = 0;
+        }
+
+        if (string_json != NULL) {
+            char* expected = json_dumps(string_json, JSON_ENCODE_ANY);
+
+            buffer_clear(&escape->buffer);
+            emit_string(&escape->buffer, text, size);
+
+            if (expected == NULL || escape->buffer.size != strlen(expected) || memcmp(escape->buffer.data, expected, escape->buffer.size) != 0) {
+                fprintf(stderr, "error: string escaping differs from jansson for string %d\n", i);
+                success = 0;
+            }
+
+            free(expected);
+            json_decref(string_json);
+        }
+    }
+
+    return success;
+}
+
+static int bench_escape(Bench* bench) {
+    const char* samples[] = {
+        "\"quoted\" \\ back\\slash\b\f\r\x01\x1f\x7f",
+        "\xe3\x81\x82\xf0\x9f\x98\x80\xef\xbf\xbf\xf4\x8f\xbf\xbf",
+        "\xc0\xaf",
+        "\xe0\x80\xaf",
+        "\xed\xa0\x80",
+        "\xf4\x90\x80\x80",
+        "\xf5\x80\x80\x80",
+        "truncated \xe3\x81",
+        "stray \x80 continuation",
+        "\xff",
+    };
+
+    /* Converted mixed text broken into entry sized strings with some escapes mixed in. */
+    char* input = bench_convert_input(50);
+    char* text = eucjp_to_utf8(input);
+    free(input);
+    if (text == NULL) {
+        fprintf(stderr, "error: failed to convert benchmark text\n");
+        return 0;
+    }
+
+    Bench_Escape escape = {};
+    const size_t text_size = strlen(text);
+    escape.strings = malloc((text_size / BENCH_ESCAPE_STRING_SIZE + ARRSIZE(samples) + 1) * sizeof(char*));
+
+    long long bytes = 0;
+    for (size_t start = 0, i = 0; start < text_size; start = i) {
+        i = start + BENCH_ESCAPE_STRING_SIZE < text_size ? start + BENCH_ESCAPE_STRING_SIZE : text_size;
+        while (i < text_size && (text[i] & 0xc0) == 0x80) {
+            ++i;
+        }
+
+        char* string = strndup(text + start, i - start);
+        for (char* space = string; (space = strchr(space, ' ')) != NULL; space += 7) {
+            *space = "\n\"\t "[(space - string) % 4];
+            if (strlen(space) < 7) {
+                break;
+            }
+        }
+
+        escape.strings[escape.string_count++] = string;
+        bytes += i - start;
+    }
+
+    const int success = bench_escape_verify(&escape);
+
+    Bench_Case bench_case = {};
+    bench_case.name = "json/escape-kernel";
+    bench_case.run = bench_escape_kernel_run;
+    bench_case.context = &escape;
+    bench_case.bytes = bytes;
+    bench_run(bench, &bench_case);
+
+    bench_case.name = "json/escape-jansson";
+    bench_case.run = bench_escape_jansson_run;
+    bench_run(bench, &bench_case);
+
+    for (unsigned i = 0; i < ARRSIZE(samples); ++i) {
+        escape.strings[escape.string_count++] = strdup(samples[i]);
+    }
+
+    const int samples_success = bench_escape_verify(&escape);
+
+    for (int i = 0; i < escape.string_count; ++i) {
+        free(escape.strings[i]);
+    }
+
+    free(escape.strings);
+    buffer_free(&escape.buffer);
+    free(text);
+
+    return success && samples_success;
+}
+
+/*
+ * Undupe
+ */
+
+static void bench_undupe_setup(void* context) {
+    Bench_Undupe* undupe = context;
+    memcpy(undupe->subbook.entries, undupe->entries, undupe->entry_count * sizeof(Book_Entry));
+    undupe->subbook.entry_count = undupe->entry_count;
+}
+
+static void bench_undupe_run(void* context) {
+    Bench_Undupe* undupe = context;
+    subbook_undupe(&undupe->subbook);
+}
+
+static void bench_undupe(Bench* bench) {
+    const struct {
+        const char* name;
+        int         duplicate_percent;
+    } ratios[] = {
+        { "undupe/duplicates-0",  0  },
+        { "undupe/duplicates-25", 25 },
+        { "undupe/duplicates-50", 50 },
+        { "undupe/duplicates-90", 90 },
+    };
+
+    for (unsigned i = 0; i < ARRSIZE(ratios); ++i) {
+        Bench_Undupe undupe = {};
+        undupe.entry_count = BENCH_UNDUPE_SIZE;
+        undupe.entries = calloc(undupe.entry_count, sizeof(Book_Entry));
+        undupe.subbook.entries = calloc(undupe.entry_count, sizeof(Book_Entry));
+        undupe.subbook.entry_alloc = undupe.entry_count;
+
+        /* Unique positions are spread over pages the way hit lists are. */
+        const int unique_count = undupe.entry_count - undupe.entry_count / 100 * ratios[i].duplicate_percent;
+        unsigned seed = 1;
+        for (int j = 0; j < undupe.entry_count; ++j) {
+            seed = seed * 1103515245 + 12345;
+            const int position = j < unique_count ? j : (int)((seed >> 8) % unique_count);
+            undupe.entries[j].text.page = position / 64;
+            undupe.entries[j].text.offset = position % 64 * 32;
+        }
+
+        Bench_Case bench_case = {};
+        bench_case.name = ratios[i].name;
+        bench_case.setup = bench_undupe_setup;
+        bench_case.run = bench_undupe_run;
+        bench_case.context = &undupe;
+        bench_run(bench, &bench_case);
+
+        free(undupe.entries);
+        free(undupe.subbook.entries);
+    }
+}
+
+/*
+ * Export
+ */
+
+static char* bench_export_text(const char* format, int index) {
+    char text[256];
+    snprintf(text, sizeof(text), format, index, index * 7919);
+    return strdup(text);
+}
+
+static void bench_export_run(void* context) {
+    Bench_Export* export = context;
+    rewind(export->fp);
+
+    Writer* writer = writer_create(export->fp, WRITER_COMPRESS_NONE, export->options.threads);
+    if (book_export(writer, &export->book, &export->options)) {
+        writer_finish(writer);
+    }
+
+    writer_destroy(writer);
+}
+
+static void bench_export(Bench* bench) {
+    const struct {
+        const char* name;
+        int         entry_count;
+    } sizes[] = {
+        { "export/entries-1000",   1000   },
+        { "export/entries-10000",  10000  },
+        { "export/entries-100000", 100000 },
+    };
+
+    for (unsigned i = 0; i < ARRSIZE(sizes); ++i) {
+        Bench_Export export = {};
+        export.options.flags = FLAG_ENTRIES | FLAG_POSITIONS;
+        export.options.threads = bench->threads;
+        export.fp = fopen(BENCH_NULL_DEVICE, "wb");
+        if (export.fp == NULL) {
+            fprintf(stderr, "error: failed to open %s\n", BENCH_NULL_DEVICE);
+            return;
+        }
+
+        Book* book = &export.book;
+        strcpy(book->char_code, "jisx0208");
+        strcpy(book->disc_code, "epwing");
+        book->subbook_count = 1;
+        book->subbooks = calloc(1, sizeof(Book_Subbook));
+
+        Book_Subbook* subbook = book->subbooks;
+        subbook->title = strdup("benchmark");
+        subbook->entry_count = sizes[i].entry_count;
+        subbook->entry_alloc = sizes[i].entry_count;
+        subbook->entries = calloc(subbook->entry_alloc, sizeof(Book_Entry));
+
+        long long bytes = 0;
+        for (int j = 0; j < subbook->entry_count; ++j) {
+            Book_Entry* entry = subbook->entries + j;
+            entry->heading.text = bench_export_text("見出し %d 【%d】", j);
+            entry->heading.page = j / 64;
+            entry->heading.offset = j % 64 * 32;
+            entry->text.text = bench_export_text(
+                "見出し %d\n本文の一行目です。\"quoted\" and\ttabbed text with escapes \\ %d\n二行目。",
+                j
+            );
+            entry->text.page = entry->heading.page;
+            entry->text.offset = entry->heading.offset;
+            bytes += strlen(entry->heading.text) + strlen(entry->text.text);
+        }
+
+        Bench_Case bench_case = {};
+        bench_case.name = sizes[i].name;
+        bench_case.run = bench_export_run;
+        bench_case.context = &export;
+        bench_case.bytes = bytes;
+        bench_run(bench, &bench_case);
+
+        Book_Subbook* subbooks = book->subbooks;
+        book_destroy(book);
+        free(subbooks);
+        fclose(export.fp);
+    }
+}
+
+/*
+ * End-to-end
+ */
+
+static void bench_import_run(void* context) {
+    Bench_Import* import = context;
+    rewind(import->fp);
+
+    Book book = {};
+    Writer* writer = writer_create(import->fp, WRITER_COMPRESS_NONE, import->options.threads);
+    import->success =
+        book_import(&book, import->path, &import->options) &&
+        book_export(writer, &book, &import->options) &&
+        writer_finish(writer) &&
+        import->success;
+
+    Book_Subbook* subbooks = book.subbooks;
+    writer_destroy(writer);
+    book_destroy(&book);
+    free(subbooks);
+}
+
+static int bench_import(Bench* bench, const char path[]) {
+    Bench_Import import = {};
+    import.path = path;
+    import.options.flags = FLAG_ENTRIES | FLAG_FONTS | FLAG_POSITIONS;
+    import.options.threads = bench->threads;
+    import.success = 1;
+    import.fp = fopen(BENCH_NULL_DEVICE, "wb");
+    if (import.fp == NULL) {
+        fprintf(stderr, "error: failed to open %s\n", BENCH_NULL_DEVICE);
+        return 0;
+    }
+
+    Bench_Case bench_case = {};
+    bench_case.name = "book/end-to-end";
+    bench_case.run = bench_import_run;
+    bench_case.context = &import;
+    bench_run(bench, &bench_case);
+
+    fclose(import.fp);
+    return import.success;
+}
+
+/*
+ * Entry point
+ */
+
+int main(int argc, char *argv[]) {
+    const struct option options[] = {
+        { "iterations", required_argument, NULL, 'i' },
+        { "filter",     required_argument, NULL, 'f' },
+        { "threads",    required_argument, NULL, 't' },
+        { NULL,         0,                 NULL,  0  },
+    };
+
+    Bench bench = {};
+    bench.iterations = 10;
+    bench.threads = parallel_cpu_count();
+
+    int c = 0;
+    while ((c = getopt_long(argc, argv, "i:f:t:", options, NULL)) != -1) {
+        switch (c) {
+            case 'i':
+                bench.iterations = atoi(optarg);
+                if (bench.iterations < 1) {
+                    fprintf(stderr, "error: invalid iteration count\n");
+                    return 1;
+                }
+                break;
+            case 'f':
+                bench.filter = optarg;
+                break;
+            case 't':
+                bench.threads = atoi(optarg);
+                if (bench.threads < 1) {
+                    fprintf(stderr, "error: invalid thread count\n");
+                    return 1;
+                }
+                break;
+            default:
+                return 1;
+        }
+    }
+
+    bench.results = json_array();
+
+    bench_convert(&bench);
+    int success = bench_escape(&bench);
+    bench_undupe(&bench);
+    bench_export(&bench);
+
+    if (optind < argc) {
+        success = bench_import(&bench, argv[optind]) && success;
+    }
+
+    json_t* bench_json = json_object();
+    json_object_set_new(bench_json, "threads", json_integer(bench.threads));
+    json_object_set_new(bench_json, "benchmarks", bench.results);
+
+    char* output = json_dumps(bench_json, JSON_INDENT(4));
+    if (output != NULL) {
+        printf("%s\n", output);
+    }
+
+    free(output);
+    json_decref(bench_json);
+
+    return success ? 0 : 1;
+}
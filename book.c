@@ -16,14 +16,30 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <limits.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <string.h>
+#include <zlib.h>
 
 #include "book.h"
+#include "book_internal.h"
+#include "buffer.h"
+#include "cache.h"
+#include "collate.h"
 #include "hooks.h"
 #include "convert.h"
+#include "emit.h"
+#include "hash.h"
+#include "intern.h"
+#include "parallel.h"
+#include "pool.h"
+#include "stats.h"
+#include "trace.h"
 #include "util.h"
 
 #include "eb/eb/eb.h"
+#include "eb/eb/binary.h"
 #include "eb/eb/font.h"
 #include "eb/eb/text.h"
 #include "eb/eb/error.h"
@@ -31,13 +47,21 @@
 #include "jansson/include/jansson.h"
 
 /*
- * Local types
+ * Macros
  */
 
-typedef enum {
-    BOOK_MODE_TEXT,
-    BOOK_MODE_HEADING,
-} Book_Mode;
+#define EXPORT_INDENT 4
+#define EXPORT_CHUNK_SIZE 1024
+#define EXPORT_FLUSH_SIZE (1024 * 1024)
+#define HASH_CHUNK_SIZE 1024
+#define FONT_CODE_WORDS (65536 / 64)
+#define READ_CHUNK_SIZE 4096
+#define PART_MAGIC "ZEPWPART"
+#define PART_VERSION 2
+
+/*
+ * Local types
+ */
 
 typedef struct Page {
     int* offsets;
@@ -45,98 +69,220 @@ typedef struct Page {
     int  offset_alloc;
 } Page;
 
-typedef struct Book_Block {
-    char* text;
-    int   page;
-    int   offset;
-} Book_Block;
-
-typedef struct Book_Entry{
-    Book_Block heading;
-    Book_Block text;
-} Book_Entry;
-
-typedef struct Book_Glyph {
-    char bitmap[EB_SIZE_WIDE_FONT_48];
-    int  code;
-} Book_Glyph;
-
-typedef struct Book_Glyph_Set {
-    Book_Glyph* glyphs;
-    int         bitmap_size;
-    int         width;
-    int         height;
-    int         count;
-} Book_Glyph_Set;
-
-typedef struct Book_Font {
-    Book_Glyph_Set wide;
-    Book_Glyph_Set narrow;
-} Book_Font;
-
-typedef struct Book_Subbook {
-    char*       title;
-    Book_Block  copyright;
-
-    Book_Entry* entries;
-    int         entry_count;
-    int         entry_alloc;
-
-    Book_Font fonts[4];
-} Book_Subbook;
-
-typedef struct Book {
-    char          char_code[32];
-    char          disc_code[32];
-    Book_Subbook* subbooks;
-    int           subbook_count;
-} Book;
+typedef struct Book_Reader {
+    EB_Book*     book;
+    EB_Hookset*  hookset;
+    Hook_Context context;
+    Buffer       text;
+    const char*  path;
+    int          flags;
+    int          threads;
+    int          part_index;
+    int          part_count;
+    const Match* match_heading;
+    const Match* match_text;
+    int          font_sizes;
+    Stats*       stats;
+    Trace*       trace;
+} Book_Reader;
+
+typedef struct Book_Font_Job {
+    const char*     path;
+    EB_Subbook_Code subbook_code;
+    Book_Subbook*   subbook;
+    const uint64_t* used;
+    int             sizes;
+    Trace*          trace;
+} Book_Font_Job;
+
+typedef struct Book_Sort_Key {
+    const char* data;
+    size_t      offset;
+    size_t      size;
+    int         index;
+} Book_Sort_Key;
+
+typedef struct Book_Media_Job {
+    const char*     path;
+    EB_Subbook_Code subbook_code;
+    Book_Subbook*   subbook;
+    const char*     media_path;
+    int             workers;
+    Trace*          trace;
+} Book_Media_Job;
+
+typedef enum {
+    EXPORT_ARRAY_ENTRIES,
+    EXPORT_ARRAY_STRINGS,
+} Export_Array;
+
+typedef struct Export_Range {
+    int start;
+    int count;
+} Export_Range;
+
+/* Strings a shard carries, by global id, and the shard id of every global string or -1. */
+typedef struct Export_Strings {
+    int* ids;
+    int* remap;
+    int  count;
+} Export_Strings;
+
+typedef struct Export_Chunk {
+    int    start;
+    int    count;
+    int    leading;
+    Buffer buffer;
+    Pool   pool;
+} Export_Chunk;
+
+typedef struct Export {
+    Writer*             writer;
+    Buffer              buffer;
+    const Book*         book;
+    const Book_Subbook* subbook;
+    json_t**            entry_arrays;
+    json_t**            string_arrays;
+    Export_Range*       ranges;
+    Export_Strings*     strings;
+    Export_Array        array;
+    Export_Chunk*       chunks;
+    Stats*              stats;
+    Trace*              trace;
+    int                 flags;
+    int                 threads;
+    int                 depth;
+    int                 success;
+    long long           bytes;
+} Export;
+
+typedef struct Part_Header {
+    int       index;
+    int       count;
+    int       flags;
+    Book_Sort sort;
+} Part_Header;
+
+typedef struct Part_Writer {
+    Writer* writer;
+    Buffer  buffer;
+    int     success;
+} Part_Writer;
+
+typedef struct Part_Reader {
+    gzFile file;
+    int    success;
+} Part_Reader;
+
+/* Sits in front of every block jansson gets during export, sized to keep the block aligned. */
+typedef union Export_Json_Header {
+    int         pooled;
+    max_align_t align;
+} Export_Json_Header;
+
+/*
+ * Local data
+ */
+
+/* Pool that jansson allocates from on this thread while exporting, see book_export. */
+static __thread Pool* s_export_pool;
 
 /*
  * Helper functions
  */
 
-static char* book_read(EB_Book* book, EB_Hookset* hookset, const EB_Position* position, Book_Mode mode) {
+static char* book_read(Book_Reader* reader, const EB_Position* position, Book_Mode mode, char** key) {
+    EB_Book* book = reader->book;
     if (eb_seek_text(book, position) != EB_SUCCESS) {
         return NULL;
     }
 
-    static char data[1024000] = {};
+    Buffer* text = &reader->text;
+    buffer_clear(text);
+
+    EB_Error_Code error = EB_SUCCESS;
     ssize_t data_length = 0;
-    EB_Error_Code error;
 
-    switch (mode) {
-        case BOOK_MODE_TEXT:
-            error = eb_read_text(
-                book,
-                NULL,
-                hookset,
-                NULL,
-                ARRSIZE(data) - 1,
-                data,
-                &data_length
-            );
+    trace_begin(reader->trace, "read", "page", position->page);
+    Stats_Clock clock = stats_begin(reader->stats);
+
+    /*
+     * The reader keeps its position between calls, so entries which do not
+     * fit are fetched in pieces until the text is stopped.
+     */
+
+    do {
+        buffer_reserve(text, READ_CHUNK_SIZE);
+        const ssize_t data_max = text->alloc - text->size - 1;
+
+        switch (mode) {
+            case BOOK_MODE_TEXT:
+                error = eb_read_text(
+                    book,
+                    NULL,
+                    reader->hookset,
+                    &reader->context,
+                    data_max,
+                    text->data + text->size,
+                    &data_length
+                );
+                break;
+            case BOOK_MODE_HEADING:
+                error = eb_read_heading(
+                    book,
+                    NULL,
+                    reader->hookset,
+                    &reader->context,
+                    data_max,
+                    text->data + text->size,
+                    &data_length
+                );
+                break;
+            default:
+                return NULL;
+        }
+
+        if (error != EB_SUCCESS) {
             break;
-        case BOOK_MODE_HEADING:
-            error = eb_read_heading(
-                book,
-                NULL,
-                hookset,
-                NULL,
-                ARRSIZE(data) - 1,
-                data,
-                &data_length
-            );
+        }
+
+        /* A short read only means the next character did not fit; libeb holds it for the next call. */
+        if (data_length == 0) {
             break;
-        default:
-            return NULL;
+        }
+
+        text->size += data_length;
     }
+    while (!eb_is_text_stopped(book));
 
+    text->data[text->size] = 0;
+
+    stats_end(reader->stats, STATS_PHASE_READ, &clock);
+    trace_end(reader->trace, "read", "bytes", text->size);
     if (error != EB_SUCCESS) {
         return NULL;
     }
 
-    char * result = eucjp_to_utf8(data);
+    stats_count(reader->stats, STATS_COUNTER_BYTES_READ, text->size);
+
+    trace_begin(reader->trace, "convert", NULL, 0);
+    clock = stats_begin(reader->stats);
+    /* The key shares the decoding pass with the text. */
+    char* result = NULL;
+    if (reader->flags & FLAG_NORMALIZE) {
+        eucjp_to_utf8_normalized(text->data, NULL, &result);
+        if (key != NULL && result != NULL) {
+            *key = strdup(result);
+        }
+    }
+    else if (key != NULL) {
+        eucjp_to_utf8_normalized(text->data, &result, key);
+    }
+    else {
+        result = eucjp_to_utf8(text->data);
+    }
+    stats_end(reader->stats, STATS_PHASE_CONVERT, &clock);
+    trace_end(reader->trace, "convert", NULL, 0);
     if (result == NULL) {
         return NULL;
     }
@@ -144,15 +290,78 @@ static char* book_read(EB_Book* book, EB_Hookset* hookset, const EB_Position* po
     return result;
 }
 
-static Book_Block book_read_content(EB_Book* book, EB_Hookset* hookset, const EB_Position* position, Book_Mode mode) {
+static Book_Block book_read_content(Book_Reader* reader, const EB_Position* position, Book_Mode mode) {
     Book_Block block = {};
-    block.text = book_read(book, hookset, position, mode);
+    hooks_context_reset(&reader->context);
+    const int keyed = mode == BOOK_MODE_HEADING && (reader->flags & FLAG_HEADING_KEY);
+    block.text = book_read(reader, position, mode, keyed ? &block.key : NULL);
     block.page = position->page;
     block.offset = position->offset;
+
+    if (block.text != NULL) {
+        const Stats_Clock clock = stats_begin(reader->stats);
+        block.text = hooks_resolve(&reader->context, block.text);
+        if (block.key != NULL) {
+            block.key = hooks_strip(&reader->context, block.key);
+        }
+        stats_end(reader->stats, STATS_PHASE_CONVERT, &clock);
+
+        if (reader->context.span_count > 0) {
+            block.span_count = reader->context.span_count;
+            block.spans = malloc(block.span_count * sizeof(Hook_Span));
+            memcpy(block.spans, reader->context.spans, block.span_count * sizeof(Hook_Span));
+        }
+
+        if (reader->context.reference_count > 0) {
+            block.reference_count = reader->context.reference_count;
+            block.references = malloc(block.reference_count * sizeof(Book_Reference));
+            for (int i = 0; i < block.reference_count; ++i) {
+                Book_Reference* reference = block.references + i;
+                reference->page = reader->context.references[i].page;
+                reference->offset = reader->context.references[i].offset;
+                reference->entry = -1;
+            }
+        }
+
+        if (reader->context.media_count > 0) {
+            block.media_count = reader->context.media_count;
+            block.media = calloc(block.media_count, sizeof(Book_Media_Ref));
+            for (int i = 0; i < block.media_count; ++i) {
+                block.media[i].source = reader->context.media[i];
+                block.media[i].media = -1;
+            }
+        }
+
+        if (reader->context.glyph_count > 0) {
+            block.glyph_count = reader->context.glyph_count;
+            block.glyphs = malloc(block.glyph_count * sizeof(Hook_Glyph));
+            memcpy(block.glyphs, reader->context.glyphs, block.glyph_count * sizeof(Hook_Glyph));
+        }
+    }
+
     return block;
 }
 
-static void subbook_undupe(Book_Subbook* subbook) {
+static void book_block_free(Book_Block* block) {
+    if (!block->interned) {
+        free(block->text);
+    }
+
+    free(block->key);
+    free(block->spans);
+    free(block->references);
+    free(block->media);
+    free(block->glyphs);
+}
+
+static void book_block_intern(Book_Block* block, Intern_Pool* pool) {
+    if (block->text != NULL) {
+        block->string_id = intern_pool_add(pool, &block->text);
+        block->interned = 1;
+    }
+}
+
+void subbook_undupe(Book_Subbook* subbook) {
     int page_count = 0;
     for (int i = 0; i < subbook->entry_count; ++i) {
         const int page_index = subbook->entries[i].text.page + 1;
@@ -212,9 +421,312 @@ static void subbook_undupe(Book_Subbook* subbook) {
     free(pages);
 }
 
-static void book_undupe(Book* book) {
+static void subbook_strings_compact(Book_Subbook* subbook) {
+    Intern_Pool* pool = &subbook->strings;
+    int* remap = malloc((pool->count > 0 ? pool->count : 1) * sizeof(int));
+    memset(remap, 0xff, pool->count * sizeof(int));
+
+    /* Drop strings orphaned by undupe and number the rest in entry order. */
+    int count = 0;
+    for (int i = 0; i < subbook->entry_count; ++i) {
+        Book_Block* blocks[] = {&subbook->entries[i].heading, &subbook->entries[i].text};
+        for (unsigned j = 0; j < ARRSIZE(blocks); ++j) {
+            Book_Block* block = blocks[j];
+            if (block->interned) {
+                if (remap[block->string_id] < 0) {
+                    remap[block->string_id] = count++;
+                }
+
+                block->string_id = remap[block->string_id];
+            }
+        }
+    }
+
+    intern_pool_compact(pool, remap, count);
+    free(remap);
+}
+
+static uint64_t subbook_position_key(int page, int offset) {
+    return (uint64_t)(unsigned)page << 32 | (unsigned)offset;
+}
+
+static void subbook_references_resolve(Book_Subbook* subbook) {
+    if (subbook->entry_count == 0) {
+        return;
+    }
+
+    /* Open addressing table from text position to entry index, kept at most half full. */
+    int slot_count = 1;
+    while (slot_count < subbook->entry_count * 2) {
+        slot_count *= 2;
+    }
+
+    int* slots = malloc(slot_count * sizeof(int));
+    memset(slots, 0xff, slot_count * sizeof(int));
+
+    for (int i = 0; i < subbook->entry_count; ++i) {
+        const Book_Block* text = &subbook->entries[i].text;
+        const uint64_t key = subbook_position_key(text->page, text->offset);
+
+        int slot = (key * 0x9e3779b97f4a7c15ULL >> 32) & (slot_count - 1);
+        while (slots[slot] >= 0) {
+            slot = (slot + 1) & (slot_count - 1);
+        }
+
+        slots[slot] = i;
+    }
+
+    for (int i = 0; i < subbook->entry_count; ++i) {
+        Book_Block* text = &subbook->entries[i].text;
+        for (int j = 0; j < text->reference_count; ++j) {
+            Book_Reference* reference = text->references + j;
+            const uint64_t key = subbook_position_key(reference->page, reference->offset);
+
+            int slot = (key * 0x9e3779b97f4a7c15ULL >> 32) & (slot_count - 1);
+            for (int index; (index = slots[slot]) >= 0; slot = (slot + 1) & (slot_count - 1)) {
+                const Book_Block* target = &subbook->entries[index].text;
+                if (target->page == reference->page && target->offset == reference->offset) {
+                    reference->entry = index;
+                    break;
+                }
+            }
+        }
+    }
+
+    free(slots);
+}
+
+static uint64_t subbook_media_hash(const Hook_Media* media) {
+    uint64_t hash = media->type;
+    for (unsigned i = 0; i < ARRSIZE(media->args); ++i) {
+        hash = (hash ^ media->args[i]) * 0x9e3779b97f4a7c15ULL;
+    }
+
+    return hash;
+}
+
+static void subbook_media_collect(Book_Subbook* subbook) {
+    int ref_count = 0;
+    for (int i = 0; i < subbook->entry_count; ++i) {
+        ref_count += subbook->entries[i].text.media_count;
+    }
+
+    if (ref_count == 0) {
+        return;
+    }
+
+    /* Open addressing table from media source to its index, kept at most half full. */
+    int slot_count = 1;
+    while (slot_count < ref_count * 2) {
+        slot_count *= 2;
+    }
+
+    int* slots = malloc(slot_count * sizeof(int));
+    memset(slots, 0xff, slot_count * sizeof(int));
+    subbook->media = malloc(ref_count * sizeof(Book_Media));
+
+    for (int i = 0; i < subbook->entry_count; ++i) {
+        Book_Block* text = &subbook->entries[i].text;
+        for (int j = 0; j < text->media_count; ++j) {
+            Book_Media_Ref* ref = text->media + j;
+
+            int slot = (subbook_media_hash(&ref->source) >> 32) & (slot_count - 1);
+            for (int index; (index = slots[slot]) >= 0; slot = (slot + 1) & (slot_count - 1)) {
+                if (memcmp(&subbook->media[index].source, &ref->source, sizeof(Hook_Media)) == 0) {
+                    ref->media = index;
+                    break;
+                }
+            }
+
+            if (ref->media < 0) {
+                ref->media = subbook->media_count++;
+                subbook->media[ref->media].source = ref->source;
+                subbook->media[ref->media].file = NULL;
+                slots[slot] = ref->media;
+            }
+        }
+    }
+
+    free(slots);
+}
+
+static void subbook_media_link(Book_Subbook* subbook) {
+    for (int i = 0; i < subbook->entry_count; ++i) {
+        Book_Block* text = &subbook->entries[i].text;
+        for (int j = 0; j < text->media_count; ++j) {
+            Book_Media_Ref* ref = text->media + j;
+            ref->file = ref->media < 0 ? NULL : subbook->media[ref->media].file;
+        }
+    }
+}
+
+/*
+ * Entries rejected by --match-heading or --match-text stay in place with just
+ * their positions until duplicates are removed, so that filtering does not
+ * change which of several hits on the same text is kept.
+ */
+
+static int subbook_unmatched_remove(Book_Subbook* subbook) {
+    int count = 0;
+    for (int i = 0; i < subbook->entry_count; ++i) {
+        if (!subbook->entries[i].unmatched) {
+            subbook->entries[count++] = subbook->entries[i];
+        }
+    }
+
+    const int removed = subbook->entry_count - count;
+    subbook->entry_count = count;
+    return removed;
+}
+
+static void subbook_entries_undupe(Book_Subbook* subbook, Book_Reader* reader) {
+    const int entry_count = subbook->entry_count;
+
+    trace_begin(reader->trace, "undupe", NULL, 0);
+    const Stats_Clock clock = stats_begin(reader->stats);
+    subbook_undupe(subbook);
+    stats_end(reader->stats, STATS_PHASE_UNDUPE, &clock);
+    trace_end(reader->trace, "undupe", NULL, 0);
+
+    stats_count(reader->stats, STATS_COUNTER_DUPLICATES, entry_count - subbook->entry_count);
+}
+
+/* Orders by collation key, then by original index to keep the sort stable. */
+static int subbook_sort_compare(const void* a, const void* b) {
+    const Book_Sort_Key* key_a = a;
+    const Book_Sort_Key* key_b = b;
+
+    const size_t size = key_a->size < key_b->size ? key_a->size : key_b->size;
+    const int result = memcmp(key_a->data, key_b->data, size);
+    if (result != 0) {
+        return result;
+    }
+
+    if (key_a->size != key_b->size) {
+        return key_a->size < key_b->size ? -1 : 1;
+    }
+
+    return (key_a->index > key_b->index) - (key_a->index < key_b->index);
+}
+
+static void subbook_sort(Book_Subbook* subbook, int flags) {
+    if (subbook->entry_count < 2) {
+        return;
+    }
+
+    /* Keys share one buffer, so they are located by offset until it stops growing. */
+    Book_Sort_Key* keys = malloc(subbook->entry_count * sizeof(Book_Sort_Key));
+    Buffer arena = {};
+    for (int i = 0; i < subbook->entry_count; ++i) {
+        const char* heading = subbook->entries[i].heading.text;
+        keys[i].offset = arena.size;
+        keys[i].index = i;
+        collate_key(&arena, heading != NULL ? heading : "", flags);
+        keys[i].size = arena.size - keys[i].offset;
+    }
+
+    for (int i = 0; i < subbook->entry_count; ++i) {
+        keys[i].data = arena.data + keys[i].offset;
+    }
+
+    qsort(keys, subbook->entry_count, sizeof(Book_Sort_Key), subbook_sort_compare);
+
+    Book_Entry* entries = malloc(subbook->entry_alloc * sizeof(Book_Entry));
+    for (int i = 0; i < subbook->entry_count; ++i) {
+        entries[i] = subbook->entries[keys[i].index];
+    }
+
+    free(subbook->entries);
+    subbook->entries = entries;
+
+    buffer_free(&arena);
+    free(keys);
+}
+
+static void book_sort(Book* book, const Book_Options* options) {
     for (int i = 0; i < book->subbook_count; ++i) {
-        subbook_undupe(book->subbooks + i);
+        stats_select(options->stats, i);
+        const Stats_Clock clock = stats_begin(options->stats);
+        subbook_sort(book->subbooks + i, options->flags);
+        stats_end(options->stats, STATS_PHASE_SORT, &clock);
+    }
+
+    stats_select(options->stats, -1);
+}
+
+/*
+ * Entries are hashed over heading and text as exported, split by a NUL byte so
+ * that text moving across the boundary changes the hash. The subbook hash runs
+ * over the entry hashes in output order, as little-endian 64-bit words.
+ */
+
+static void subbook_hash_worker(void* context, int index) {
+    Book_Subbook* subbook = context;
+    const int start = index * HASH_CHUNK_SIZE;
+    const int end = subbook->entry_count - start < HASH_CHUNK_SIZE ? subbook->entry_count : start + HASH_CHUNK_SIZE;
+
+    for (int i = start; i < end; ++i) {
+        Book_Entry* entry = subbook->entries + i;
+
+        Hash_State state;
+        hash_init(&state, 0);
+        if (entry->heading.text != NULL) {
+            hash_update(&state, entry->heading.text, strlen(entry->heading.text));
+        }
+
+        hash_update(&state, "", 1);
+        if (entry->text.text != NULL) {
+            hash_update(&state, entry->text.text, strlen(entry->text.text));
+        }
+
+        entry->hash = hash_finish(&state);
+    }
+}
+
+static void subbook_hash(Book_Subbook* subbook, int threads) {
+    parallel_for((subbook->entry_count + HASH_CHUNK_SIZE - 1) / HASH_CHUNK_SIZE, threads, subbook_hash_worker, subbook);
+
+    Hash_State state;
+    hash_init(&state, 0);
+    for (int i = 0; i < subbook->entry_count; ++i) {
+        char word[8];
+        for (int j = 0; j < 8; ++j) {
+            word[j] = subbook->entries[i].hash >> (j * 8);
+        }
+
+        hash_update(&state, word, sizeof(word));
+    }
+
+    subbook->hash = hash_finish(&state);
+}
+
+static void book_finish(Book* book, const Book_Options* options) {
+    if (options->sort == BOOK_SORT_HEADING) {
+        trace_begin(options->trace, "sort", NULL, 0);
+        book_sort(book, options);
+        trace_end(options->trace, "sort", NULL, 0);
+    }
+
+    if (options->flags & FLAG_REFERENCES) {
+        trace_begin(options->trace, "references", NULL, 0);
+        for (int i = 0; i < book->subbook_count; ++i) {
+            subbook_references_resolve(book->subbooks + i);
+        }
+        trace_end(options->trace, "references", NULL, 0);
+    }
+
+    if (options->flags & FLAG_HASHES) {
+        trace_begin(options->trace, "hash", NULL, 0);
+        for (int i = 0; i < book->subbook_count; ++i) {
+            subbook_hash(book->subbooks + i, options->threads);
+        }
+        trace_end(options->trace, "hash", NULL, 0);
+    }
+
+    if (options->flags & FLAG_INTERN) {
+        for (int i = 0; i < book->subbook_count; ++i) {
+            subbook_strings_compact(book->subbooks + i);
+        }
     }
 }
 
@@ -222,9 +734,86 @@ static void book_undupe(Book* book) {
  * Encoding to JSON
  */
 
-static void entry_encode(json_t* entry_json, const Book_Entry* entry, int flags) {
-    if (entry->heading.text != NULL) {
-        json_object_set_new(entry_json, "heading", json_string(entry->heading.text));
+/* Like json_string, but validates with the emit kernel instead of jansson's scalar check. */
+static json_t* string_encode(const char text[]) {
+    const size_t size = strlen(text);
+    return emit_utf8_check(text, size) ? json_stringn_nocheck(text, size) : NULL;
+}
+
+static json_t* hash_encode(uint64_t hash) {
+    char hex[17];
+    snprintf(hex, ARRSIZE(hex), "%016llx", (unsigned long long)hash);
+    return json_string(hex);
+}
+
+static json_t* spans_encode(const Book_Block* block) {
+    json_t* span_json_array = json_array();
+    for (int i = 0; i < block->span_count; ++i) {
+        const Hook_Span* span = block->spans + i;
+
+        json_t* span_json = json_object();
+        json_object_set_new(span_json, "type", json_string(span->type));
+        json_object_set_new(span_json, "start", json_integer(span->start));
+        json_object_set_new(span_json, "end", json_integer(span->end));
+
+        if (span->attr_count > 0) {
+            json_t* attr_json = json_object();
+            for (int j = 0; j < span->attr_count; ++j) {
+                json_object_set_new(attr_json, span->attrs[j].name, json_integer(span->attrs[j].value));
+            }
+
+            json_object_set_new(span_json, "attributes", attr_json);
+        }
+
+        json_array_append_new(span_json_array, span_json);
+    }
+
+    return span_json_array;
+}
+
+static json_t* references_encode(const Book_Block* block) {
+    json_t* reference_json_array = json_array();
+    for (int i = 0; i < block->reference_count; ++i) {
+        const Book_Reference* reference = block->references + i;
+
+        json_t* reference_json = json_object();
+        json_object_set_new(reference_json, "page", json_integer(reference->page));
+        json_object_set_new(reference_json, "offset", json_integer(reference->offset));
+        json_object_set_new(reference_json, "entry", reference->entry < 0 ? json_null() : json_integer(reference->entry));
+        json_array_append_new(reference_json_array, reference_json);
+    }
+
+    return reference_json_array;
+}
+
+static json_t* media_encode(const Book_Block* block) {
+    const char* types[] = {"color_bmp", "color_jpeg", "wave", "mpeg"};
+
+    json_t* media_json_array = json_array();
+    for (int i = 0; i < block->media_count; ++i) {
+        const Book_Media_Ref* ref = block->media + i;
+
+        json_t* media_json = json_object();
+        json_object_set_new(media_json, "type", json_string(types[ref->source.type]));
+        json_object_set_new(media_json, "file", ref->file == NULL ? json_null() : json_string(ref->file));
+        json_array_append_new(media_json_array, media_json);
+    }
+
+    return media_json_array;
+}
+
+/* String ids are renumbered through the remap if one is given, as when exporting a shard. */
+static void entry_encode(json_t* entry_json, const Book_Entry* entry, int flags, const int string_remap[]) {
+    if (entry->heading.interned) {
+        const int string_id = string_remap != NULL ? string_remap[entry->heading.string_id] : entry->heading.string_id;
+        json_object_set_new(entry_json, "headingId", json_integer(string_id));
+    }
+    else if (entry->heading.text != NULL) {
+        json_object_set_new(entry_json, "heading", string_encode(entry->heading.text));
+    }
+
+    if (entry->heading.key != NULL) {
+        json_object_set_new(entry_json, "headingKey", string_encode(entry->heading.key));
     }
 
     if (flags & FLAG_POSITIONS) {
@@ -232,14 +821,53 @@ static void entry_encode(json_t* entry_json, const Book_Entry* entry, int flags)
         json_object_set_new(entry_json, "headingOffset", json_integer(entry->heading.offset));
     }
 
-    if (entry->text.text != NULL) {
-        json_object_set_new(entry_json, "text", json_string(entry->text.text));
+    if (flags & FLAG_MARKUP_SPANS) {
+        json_object_set_new(entry_json, "headingMarkup", spans_encode(&entry->heading));
+    }
+
+    if (entry->text.interned) {
+        const int string_id = string_remap != NULL ? string_remap[entry->text.string_id] : entry->text.string_id;
+        json_object_set_new(entry_json, "textId", json_integer(string_id));
+    }
+    else if (entry->text.text != NULL) {
+        json_object_set_new(entry_json, "text", string_encode(entry->text.text));
     }
 
     if (flags & FLAG_POSITIONS) {
         json_object_set_new(entry_json, "textPage", json_integer(entry->text.page));
         json_object_set_new(entry_json, "textOffset", json_integer(entry->text.offset));
     }
+
+    if (flags & FLAG_MARKUP_SPANS) {
+        json_object_set_new(entry_json, "markup", spans_encode(&entry->text));
+    }
+
+    if (flags & FLAG_REFERENCES) {
+        json_object_set_new(entry_json, "references", references_encode(&entry->text));
+    }
+
+    if (flags & FLAG_MEDIA) {
+        json_object_set_new(entry_json, "media", media_encode(&entry->text));
+    }
+
+    if (flags & FLAG_HASHES) {
+        json_object_set_new(entry_json, "hash", hash_encode(entry->hash));
+    }
+}
+
+static void fetch_encode(json_t* fetch_json, const Book_Fetch* fetch, int flags) {
+    json_object_set_new(fetch_json, "subbook", json_integer(fetch->subbook));
+    json_object_set_new(fetch_json, "page", json_integer(fetch->block.page));
+    json_object_set_new(fetch_json, "offset", json_integer(fetch->block.offset));
+    json_object_set_new(fetch_json, "mode", json_string(fetch->mode == BOOK_MODE_HEADING ? "heading" : "text"));
+
+    if (fetch->block.text != NULL) {
+        json_object_set_new(fetch_json, "text", string_encode(fetch->block.text));
+    }
+
+    if (flags & FLAG_MARKUP_SPANS) {
+        json_object_set_new(fetch_json, "markup", spans_encode(&fetch->block));
+    }
 }
 
 static void font_glyph_encode(json_t* glyph_json, const Book_Glyph* glyph, int bitmap_size) {
@@ -281,11 +909,11 @@ static void font_encode(json_t* font_json, const Book_Font* font) {
 
 static void subbook_encode(json_t* subbook_json, const Book_Subbook* subbook, int flags) {
     if (subbook->title != NULL) {
-        json_object_set_new(subbook_json, "title", json_string(subbook->title));
+        json_object_set_new(subbook_json, "title", string_encode(subbook->title));
     }
 
     if (subbook->copyright.text != NULL) {
-        json_object_set_new(subbook_json, "copyright", json_string(subbook->copyright.text));
+        json_object_set_new(subbook_json, "copyright", string_encode(subbook->copyright.text));
     }
 
     if (flags & FLAG_POSITIONS) {
@@ -307,15 +935,17 @@ static void subbook_encode(json_t* subbook_json, const Book_Subbook* subbook, in
         json_object_set_new(subbook_json, "fonts", font_json_array);
     }
 
+    if (flags & FLAG_HASHES) {
+        json_object_set_new(subbook_json, "hash", hash_encode(subbook->hash));
+    }
+
     if (flags & FLAG_ENTRIES) {
-        json_t* entry_json_array = json_array();
-        for (int i = 0; i < subbook->entry_count; ++i) {
-            json_t* entry_json = json_object();
-            entry_encode(entry_json, subbook->entries + i, flags);
-            json_array_append_new(entry_json_array, entry_json);
+        /* Strings and entries are encoded in chunks while exporting; see export_array. */
+        if (flags & FLAG_INTERN) {
+            json_object_set_new(subbook_json, "strings", json_array());
         }
 
-        json_object_set_new(subbook_json, "entries", entry_json_array);
+        json_object_set_new(subbook_json, "entries", json_array());
     }
 }
 
@@ -331,189 +961,1606 @@ static void book_encode(json_t* book_json, const Book* book, int flags) {
     }
 
     json_object_set_new(book_json, "subbooks", subbook_json_array);
+
+    if (book->fetches != NULL) {
+        json_t* fetch_json_array = json_array();
+        for (int i = 0; i < book->fetch_count; ++i) {
+            json_t* fetch_json = json_object();
+            fetch_encode(fetch_json, book->fetches + i, flags);
+            json_array_append_new(fetch_json_array, fetch_json);
+        }
+
+        json_object_set_new(book_json, "fetches", fetch_json_array);
+    }
 }
 
 /*
- * Importing from EPWING
+ * Exporting to JSON
  */
 
-static void subbook_entries_import(Book_Subbook* subbook, EB_Book* eb_book, EB_Hookset* eb_hookset) {
-    if (subbook->entry_alloc == 0) {
-        subbook->entry_alloc = 16384;
-        subbook->entries = malloc(subbook->entry_alloc * sizeof(Book_Entry));
+/*
+ * jansson's allocation hooks are process wide while the pool is thread local,
+ * so every block carries a header saying where it came from; a free is then
+ * right whichever thread makes it and whatever pool that thread has bound.
+ */
+
+static void* export_json_malloc(size_t size) {
+    Export_Json_Header* header = NULL;
+    if (s_export_pool != NULL) {
+        header = pool_alloc(s_export_pool, sizeof(Export_Json_Header) + size);
+    }
+    else {
+        header = malloc(sizeof(Export_Json_Header) + size);
     }
 
-    EB_Hit hits[256] = {};
-    int hit_count = 0;
+    if (header == NULL) {
+        return NULL;
+    }
 
-    do {
-        if (eb_hit_list(eb_book, ARRSIZE(hits), hits, &hit_count) != EB_SUCCESS) {
-            continue;
-        }
+    header->pooled = s_export_pool != NULL;
+    return header + 1;
+}
 
-        for (int i = 0; i < hit_count; ++i) {
-            EB_Hit* hit = hits + i;
+static void export_json_free(void* ptr) {
+    if (ptr == NULL) {
+        return;
+    }
 
-            if (subbook->entry_count == subbook->entry_alloc) {
+    /* Pooled blocks are released with their pool. */
+    Export_Json_Header* header = (Export_Json_Header*)ptr - 1;
+    if (!header->pooled) {
+        free(header);
+    }
+}
+
+static void export_write(Export* export, const Buffer* buffer) {
+    trace_begin(export->trace, "write", "bytes", buffer->size);
+    const Stats_Clock clock = stats_begin(export->stats);
+    export->success = writer_write(export->writer, buffer->data, buffer->size) && export->success;
+    stats_end(export->stats, STATS_PHASE_WRITE, &clock);
+    trace_end(export->trace, "write", NULL, 0);
+    stats_count(export->stats, STATS_COUNTER_BYTES_EMITTED, buffer->size);
+    export->bytes += buffer->size;
+}
+
+static void export_flush(Export* export) {
+    if (export->buffer.size > 0) {
+        export_write(export, &export->buffer);
+        buffer_clear(&export->buffer);
+    }
+}
+
+static void export_indent(Buffer* buffer, int flags, int depth) {
+    if (flags & FLAG_PRETTY_PRINT) {
+        const int width = depth * EXPORT_INDENT;
+        buffer_reserve(buffer, width + 1);
+        buffer->data[buffer->size++] = '\n';
+        memset(buffer->data + buffer->size, ' ', width);
+        buffer->size += width;
+    }
+}
+
+/*
+ * Writes a value at the given depth in the same format that jansson would
+ * produce when dumping the whole document; strings go through the emit
+ * kernel instead of jansson's byte by byte escaping.
+ */
+
+static void export_dump(Buffer* buffer, const json_t* json, int flags, int depth) {
+    switch (json_typeof(json)) {
+        case JSON_OBJECT: {
+            void* iter = json_object_iter((json_t*)json);
+            buffer_append_char(buffer, '{');
+            if (iter == NULL) {
+                buffer_append_char(buffer, '}');
+                break;
+            }
+
+            export_indent(buffer, flags, depth + 1);
+            while (iter != NULL) {
+                const char* key = json_object_iter_key(iter);
+                emit_string(buffer, key, strlen(key));
+                buffer_append_string(buffer, flags & FLAG_PRETTY_PRINT ? ": " : ":");
+                export_dump(buffer, json_object_iter_value(iter), flags, depth + 1);
+
+                iter = json_object_iter_next((json_t*)json, iter);
+                if (iter != NULL) {
+                    buffer_append_char(buffer, ',');
+                    export_indent(buffer, flags, depth + 1);
+                }
+                else {
+                    export_indent(buffer, flags, depth);
+                }
+            }
+
+            buffer_append_char(buffer, '}');
+            break;
+        }
+        case JSON_ARRAY: {
+            const size_t count = json_array_size(json);
+            buffer_append_char(buffer, '[');
+            if (count == 0) {
+                buffer_append_char(buffer, ']');
+                break;
+            }
+
+            export_indent(buffer, flags, depth + 1);
+            for (size_t i = 0; i < count; ++i) {
+                export_dump(buffer, json_array_get(json, i), flags, depth + 1);
+                if (i + 1 < count) {
+                    buffer_append_char(buffer, ',');
+                    export_indent(buffer, flags, depth + 1);
+                }
+                else {
+                    export_indent(buffer, flags, depth);
+                }
+            }
+
+            buffer_append_char(buffer, ']');
+            break;
+        }
+        case JSON_STRING:
+            emit_string(buffer, json_string_value(json), json_string_length(json));
+            break;
+        case JSON_INTEGER: {
+            char number[32];
+            snprintf(number, ARRSIZE(number), "%" JSON_INTEGER_FORMAT, json_integer_value(json));
+            buffer_append_string(buffer, number);
+            break;
+        }
+        case JSON_TRUE:
+            buffer_append_string(buffer, "true");
+            break;
+        case JSON_FALSE:
+            buffer_append_string(buffer, "false");
+            break;
+        case JSON_NULL:
+            buffer_append_string(buffer, "null");
+            break;
+        default: {
+            char* output = json_dumps(json, JSON_ENCODE_ANY | JSON_COMPACT);
+            if (output != NULL) {
+                buffer_append_string(buffer, output);
+                export_json_free(output);
+            }
+            break;
+        }
+    }
+}
+
+static void export_chunk_encode(void* context, int index) {
+    const Export* export = context;
+    Export_Chunk* chunk = export->chunks + index;
+    trace_begin(export->trace, "chunk", "count", chunk->count);
+
+    const Export_Strings* strings = export->strings + (export->subbook - export->book->subbooks);
+
+    /* The calling thread also runs chunks, so restore whatever pool it had. */
+    Pool* pool = s_export_pool;
+    s_export_pool = &chunk->pool;
+
+    for (int i = chunk->start; i < chunk->start + chunk->count; ++i) {
+        if (chunk->leading || i > chunk->start) {
+            buffer_append_char(&chunk->buffer, ',');
+        }
+
+        export_indent(&chunk->buffer, export->flags, export->depth + 1);
+
+        json_t* item_json = NULL;
+        switch (export->array) {
+            case EXPORT_ARRAY_ENTRIES:
+                item_json = json_object();
+                entry_encode(item_json, export->subbook->entries + i, export->flags, strings->remap);
+                break;
+            case EXPORT_ARRAY_STRINGS:
+                /* Strings which are not valid UTF-8 stay in place as null so ids line up. */
+                if ((item_json = string_encode(export->subbook->strings.strings[strings->ids != NULL ? strings->ids[i] : i])) == NULL) {
+                    item_json = json_null();
+                }
+                break;
+        }
+
+        /* Never released: the reset below takes the item with it, see book_export. */
+        export_dump(&chunk->buffer, item_json, export->flags, export->depth + 1);
+    }
+
+    pool_reset(&chunk->pool);
+    s_export_pool = pool;
+
+    trace_end(export->trace, "chunk", "bytes", chunk->buffer.size);
+}
+
+static void export_array(Export* export, int subbook_index, Export_Array array, int depth) {
+    const Book_Subbook* subbook = export->book->subbooks + subbook_index;
+
+    /* Entries are limited to the range being exported; strings to those a shard refers to. */
+    const Export_Strings* strings = export->strings + subbook_index;
+    int item_start = 0;
+    int item_count = strings->ids != NULL ? strings->count : subbook->strings.count;
+    if (array == EXPORT_ARRAY_ENTRIES) {
+        item_start = export->ranges[subbook_index].start;
+        item_count = export->ranges[subbook_index].count;
+    }
+
+    buffer_append_char(&export->buffer, '[');
+    if (item_count == 0) {
+        buffer_append_char(&export->buffer, ']');
+        return;
+    }
+
+    export_flush(export);
+    stats_select(export->stats, subbook_index);
+    trace_begin(export->trace, "export subbook", "index", subbook_index);
+
+    const int chunk_count = (item_count + EXPORT_CHUNK_SIZE - 1) / EXPORT_CHUNK_SIZE;
+    const int batch_size = export->threads * 4;
+
+    export->chunks = calloc(batch_size, sizeof(Export_Chunk));
+    export->subbook = subbook;
+    export->array = array;
+    export->depth = depth;
+
+    for (int i = 0; i < chunk_count; i += batch_size) {
+        const int batch_count = chunk_count - i < batch_size ? chunk_count - i : batch_size;
+        for (int j = 0; j < batch_count; ++j) {
+            Export_Chunk* chunk = export->chunks + j;
+            const int offset = (i + j) * EXPORT_CHUNK_SIZE;
+            chunk->start = item_start + offset;
+            chunk->count = item_count - offset < EXPORT_CHUNK_SIZE ? item_count - offset : EXPORT_CHUNK_SIZE;
+            chunk->leading = offset > 0;
+        }
+
+        const Stats_Clock clock = stats_begin(export->stats);
+        parallel_for(batch_count, export->threads, export_chunk_encode, export);
+        stats_end(export->stats, STATS_PHASE_ENCODE, &clock);
+
+        for (int j = 0; j < batch_count; ++j) {
+            Export_Chunk* chunk = export->chunks + j;
+            export_write(export, &chunk->buffer);
+            buffer_clear(&chunk->buffer);
+        }
+    }
+
+    for (int i = 0; i < batch_size; ++i) {
+        stats_count(export->stats, STATS_COUNTER_JSON_ALLOCATIONS, export->chunks[i].pool.allocations);
+        pool_free(&export->chunks[i].pool);
+        buffer_free(&export->chunks[i].buffer);
+    }
+
+    free(export->chunks);
+    export->chunks = NULL;
+
+    stats_select(export->stats, -1);
+    trace_end(export->trace, "export subbook", NULL, 0);
+
+    export_indent(&export->buffer, export->flags, depth);
+    buffer_append_char(&export->buffer, ']');
+}
+
+/*
+ * Walks the document the same way json_dumps does, so the output is identical
+ * to dumping it in one piece, except that entry arrays are streamed in chunks.
+ */
+
+static void export_value(Export* export, const json_t* json, int depth) {
+    Buffer* buffer = &export->buffer;
+    if (buffer->size >= EXPORT_FLUSH_SIZE) {
+        export_flush(export);
+    }
+
+    if (json_is_object(json)) {
+        void* iter = json_object_iter((json_t*)json);
+        buffer_append_char(buffer, '{');
+        if (iter == NULL) {
+            buffer_append_char(buffer, '}');
+            return;
+        }
+
+        export_indent(buffer, export->flags, depth + 1);
+        while (iter != NULL) {
+            buffer_append_char(buffer, '"');
+            buffer_append_string(buffer, json_object_iter_key(iter));
+            buffer_append_string(buffer, export->flags & FLAG_PRETTY_PRINT ? "\": " : "\":");
+            export_value(export, json_object_iter_value(iter), depth + 1);
+
+            iter = json_object_iter_next((json_t*)json, iter);
+            if (iter != NULL) {
+                buffer_append_char(buffer, ',');
+                export_indent(buffer, export->flags, depth + 1);
+            }
+            else {
+                export_indent(buffer, export->flags, depth);
+            }
+        }
+
+        buffer_append_char(buffer, '}');
+    }
+    else if (json_is_array(json)) {
+        for (int i = 0; i < export->book->subbook_count; ++i) {
+            if (export->entry_arrays[i] == json) {
+                export_array(export, i, EXPORT_ARRAY_ENTRIES, depth);
+                return;
+            }
+
+            if (export->string_arrays[i] == json) {
+                export_array(export, i, EXPORT_ARRAY_STRINGS, depth);
+                return;
+            }
+        }
+
+        const size_t count = json_array_size(json);
+        buffer_append_char(buffer, '[');
+        if (count == 0) {
+            buffer_append_char(buffer, ']');
+            return;
+        }
+
+        export_indent(buffer, export->flags, depth + 1);
+        for (size_t i = 0; i < count; ++i) {
+            export_value(export, json_array_get(json, i), depth + 1);
+            if (i + 1 < count) {
+                buffer_append_char(buffer, ',');
+                export_indent(buffer, export->flags, depth + 1);
+            }
+            else {
+                export_indent(buffer, export->flags, depth);
+            }
+        }
+
+        buffer_append_char(buffer, ']');
+    }
+    else {
+        export_dump(buffer, json, export->flags, depth);
+    }
+}
+
+static void export_init(Export* export, Writer* writer, const Book* book, const Book_Options* options) {
+    memset(export, 0, sizeof(Export));
+    export->writer = writer;
+    export->book = book;
+    export->stats = options->stats;
+    export->trace = options->trace;
+    export->flags = options->flags;
+    export->threads = options->threads;
+    export->success = 1;
+
+    export->entry_arrays = calloc(book->subbook_count + 1, sizeof(json_t*));
+    export->string_arrays = calloc(book->subbook_count + 1, sizeof(json_t*));
+    export->ranges = calloc(book->subbook_count + 1, sizeof(Export_Range));
+    export->strings = calloc(book->subbook_count + 1, sizeof(Export_Strings));
+    for (int i = 0; i < book->subbook_count; ++i) {
+        export->ranges[i].count = book->subbooks[i].entry_count;
+    }
+}
+
+static void export_finish(Export* export) {
+    export_flush(export);
+    buffer_free(&export->buffer);
+    free(export->entry_arrays);
+    free(export->string_arrays);
+    free(export->ranges);
+
+    for (int i = 0; i < export->book->subbook_count; ++i) {
+        free(export->strings[i].ids);
+        free(export->strings[i].remap);
+    }
+
+    free(export->strings);
+}
+
+/*
+ * Shards are cut by an estimate of each entry's encoded size, taken from the
+ * length of its heading and text, so that files come out about even without
+ * encoding anything twice. An interned string is counted once, with the entry
+ * that first refers to it. Ranges are stored shard by shard, with one slot
+ * for every subbook.
+ */
+
+static long long shard_block_weight(const Book_Block* block, const Intern_Pool* strings, unsigned char seen[]) {
+    if (block->interned) {
+        long long weight = 8;
+        if (!seen[block->string_id]) {
+            seen[block->string_id] = 1;
+            weight += strlen(strings->strings[block->string_id]);
+        }
+
+        return weight;
+    }
+
+    return block->text != NULL ? strlen(block->text) : 0;
+}
+
+static long long* shard_entry_weights(const Book_Subbook* subbook) {
+    long long* weights = malloc((subbook->entry_count > 0 ? subbook->entry_count : 1) * sizeof(long long));
+    unsigned char* seen = calloc(subbook->strings.count + 1, 1);
+    for (int i = 0; i < subbook->entry_count; ++i) {
+        const Book_Entry* entry = subbook->entries + i;
+        weights[i] = 16;
+        weights[i] += shard_block_weight(&entry->heading, &subbook->strings, seen);
+        weights[i] += shard_block_weight(&entry->text, &subbook->strings, seen);
+    }
+
+    free(seen);
+    return weights;
+}
+
+static Export_Range* shard_plan(const Book* book, const Book_Options* options, int* shard_count) {
+    const int group_count = options->shard_by == BOOK_SHARD_SUBBOOK ? book->subbook_count : 1;
+    *shard_count = group_count * options->shard_count;
+
+    long long** weights = calloc(book->subbook_count + 1, sizeof(long long*));
+    for (int i = 0; i < book->subbook_count; ++i) {
+        weights[i] = shard_entry_weights(book->subbooks + i);
+    }
+
+    Export_Range* ranges = calloc(*shard_count * book->subbook_count + 1, sizeof(Export_Range));
+    for (int i = 0; i < group_count; ++i) {
+        const int first = options->shard_by == BOOK_SHARD_SUBBOOK ? i : 0;
+        const int last = options->shard_by == BOOK_SHARD_SUBBOOK ? i + 1 : book->subbook_count;
+
+        long long total = 0;
+        for (int j = first; j < last; ++j) {
+            const Book_Subbook* subbook = book->subbooks + j;
+            for (int k = 0; k < subbook->entry_count; ++k) {
+                total += weights[j][k];
+            }
+        }
+
+        long long weight = 0;
+        for (int j = first; j < last; ++j) {
+            const Book_Subbook* subbook = book->subbooks + j;
+            for (int k = 0; k < subbook->entry_count; ++k) {
+                const int shard = i * options->shard_count + (int)(weight * options->shard_count / total);
+                Export_Range* range = ranges + shard * book->subbook_count + j;
+                if (range->count++ == 0) {
+                    range->start = k;
+                }
+
+                weight += weights[j][k];
+            }
+        }
+    }
+
+    for (int i = 0; i < book->subbook_count; ++i) {
+        free(weights[i]);
+    }
+
+    free(weights);
+    return ranges;
+}
+
+/* Picks out the strings a shard's entries refer to, numbered in order of first use like a whole subbook's. */
+static void shard_strings_select(Export_Strings* strings, const Book_Subbook* subbook, const Export_Range* range) {
+    const int string_count = subbook->strings.count > 0 ? subbook->strings.count : 1;
+    strings->ids = malloc(string_count * sizeof(int));
+    strings->remap = malloc(string_count * sizeof(int));
+    memset(strings->remap, 0xff, string_count * sizeof(int));
+    strings->count = 0;
+
+    for (int i = range->start; i < range->start + range->count; ++i) {
+        const Book_Block* blocks[] = {&subbook->entries[i].heading, &subbook->entries[i].text};
+        for (unsigned j = 0; j < ARRSIZE(blocks); ++j) {
+            const Book_Block* block = blocks[j];
+            if (block->interned && strings->remap[block->string_id] < 0) {
+                strings->remap[block->string_id] = strings->count;
+                strings->ids[strings->count++] = block->string_id;
+            }
+        }
+    }
+}
+
+static char* shard_path(const char prefix[], int index, Writer_Compress compress) {
+    const char* extension = compress == WRITER_COMPRESS_GZIP ? ".json.gz" : ".json";
+    const int size = snprintf(NULL, 0, "%s-%d%s", prefix, index, extension) + 1;
+    char* path = malloc(size);
+    snprintf(path, size, "%s-%d%s", prefix, index, extension);
+    return path;
+}
+
+static void shard_encode(json_t* shard_json, Export* export, int index, int count) {
+    const Book* book = export->book;
+    json_object_set_new(shard_json, "charCode", json_string(book->char_code));
+    json_object_set_new(shard_json, "discCode", json_string(book->disc_code));
+    json_object_set_new(shard_json, "shard", json_integer(index));
+    json_object_set_new(shard_json, "shardCount", json_integer(count));
+
+    /* Fonts are left to the manifest; each shard carries the interned strings its entries refer to. */
+    json_t* subbook_json_array = json_array();
+    for (int i = 0; i < book->subbook_count; ++i) {
+        if (export->ranges[i].count == 0) {
+            continue;
+        }
+
+        json_t* subbook_json = json_object();
+        json_object_set_new(subbook_json, "subbook", json_integer(i));
+        json_object_set_new(subbook_json, "entryStart", json_integer(export->ranges[i].start));
+        subbook_encode(subbook_json, book->subbooks + i, export->flags & ~FLAG_FONTS);
+        export->entry_arrays[i] = json_object_get(subbook_json, "entries");
+        export->string_arrays[i] = json_object_get(subbook_json, "strings");
+        json_array_append_new(subbook_json_array, subbook_json);
+    }
+
+    json_object_set_new(shard_json, "subbooks", subbook_json_array);
+}
+
+static json_t* shard_manifest_encode(const char path[], const Export_Range ranges[], int subbook_count, long long bytes) {
+    json_t* manifest_json = json_object();
+    json_object_set_new(manifest_json, "file", json_string(path));
+    json_object_set_new(manifest_json, "bytes", json_integer(bytes));
+
+    json_t* subbook_json_array = json_array();
+    for (int i = 0; i < subbook_count; ++i) {
+        if (ranges[i].count > 0) {
+            json_t* subbook_json = json_object();
+            json_object_set_new(subbook_json, "subbook", json_integer(i));
+            json_object_set_new(subbook_json, "entryStart", json_integer(ranges[i].start));
+            json_object_set_new(subbook_json, "entryCount", json_integer(ranges[i].count));
+            json_array_append_new(subbook_json_array, subbook_json);
+        }
+    }
+
+    json_object_set_new(manifest_json, "subbooks", subbook_json_array);
+    return manifest_json;
+}
+
+
+static void book_block_place(Book_Block* block, const EB_Position* position) {
+    memset(block, 0, sizeof(Book_Block));
+    block->page = position->page;
+    block->offset = position->offset;
+}
+
+static void subbook_entry_read(Book_Subbook* subbook, Book_Reader* reader, Book_Entry* entry, const EB_Position* heading, const EB_Position* text) {
+    entry->heading = book_read_content(reader, heading, BOOK_MODE_HEADING);
+    entry->unmatched = 0;
+
+    /* The heading is checked first, so that text is never read for entries it rules out. */
+    if (reader->match_heading != NULL && !match_test(reader->match_heading, entry->heading.text)) {
+        book_block_free(&entry->heading);
+        book_block_place(&entry->heading, heading);
+        book_block_place(&entry->text, text);
+        entry->unmatched = 1;
+        return;
+    }
+
+    if ((reader->flags & FLAG_HEADINGS) && reader->match_text == NULL) {
+        /* Only the position of the text is kept, so no body is read or converted. */
+        book_block_place(&entry->text, text);
+    }
+    else {
+        entry->text = book_read_content(reader, text, BOOK_MODE_TEXT);
+    }
+
+    if (reader->match_text != NULL) {
+        const int matched = match_test(reader->match_text, entry->text.text);
+        if (!matched || (reader->flags & FLAG_HEADINGS)) {
+            book_block_free(&entry->text);
+            book_block_place(&entry->text, text);
+        }
+
+        if (!matched) {
+            book_block_free(&entry->heading);
+            book_block_place(&entry->heading, heading);
+            entry->unmatched = 1;
+            return;
+        }
+    }
+
+    if (reader->flags & FLAG_INTERN) {
+        book_block_intern(&entry->heading, &subbook->strings);
+        book_block_intern(&entry->text, &subbook->strings);
+    }
+}
+
+static void subbook_entries_import(Book_Subbook* subbook, Book_Reader* reader, const char pass[]) {
+    if (subbook->entry_alloc == 0) {
+        subbook->entry_alloc = 16384;
+        subbook->entries = malloc(subbook->entry_alloc * sizeof(Book_Entry));
+    }
+
+    EB_Hit hits[256] = {};
+    int hit_count = 0;
+
+    trace_begin(reader->trace, pass, NULL, 0);
+
+    do {
+        trace_begin(reader->trace, "hits", NULL, 0);
+        const Stats_Clock clock = stats_begin(reader->stats);
+        const EB_Error_Code error = eb_hit_list(reader->book, ARRSIZE(hits), hits, &hit_count);
+        stats_end(reader->stats, STATS_PHASE_HITS, &clock);
+        trace_end(reader->trace, "hits", "count", hit_count);
+        if (error != EB_SUCCESS) {
+            continue;
+        }
+
+        stats_count(reader->stats, STATS_COUNTER_HITS, hit_count);
+
+        for (int i = 0; i < hit_count; ++i) {
+            EB_Hit* hit = hits + i;
+
+            if (subbook->entry_count == subbook->entry_alloc) {
                 subbook->entry_alloc *= 2;
                 subbook->entries = realloc(subbook->entries, subbook->entry_alloc * sizeof(Book_Entry));
             }
 
-            Book_Entry* entry = subbook->entries + subbook->entry_count++;
-            entry->heading = book_read_content(eb_book, eb_hookset, &hit->heading, BOOK_MODE_HEADING);
-            entry->text = book_read_content(eb_book, eb_hookset, &hit->text, BOOK_MODE_TEXT);
+            Book_Entry* entry = subbook->entries + subbook->entry_count++;
+            if (reader->part_count > 0) {
+                /* Parts only note positions here, and read their own range later; see subbook_part_read. */
+                memset(entry, 0, sizeof(Book_Entry));
+                book_block_place(&entry->heading, &hit->heading);
+                book_block_place(&entry->text, &hit->text);
+            }
+            else {
+                subbook_entry_read(subbook, reader, entry, &hit->heading, &hit->text);
+            }
+        }
+    }
+    while (hit_count > 0);
+
+    trace_end(reader->trace, pass, NULL, 0);
+}
+
+/*
+ * Every part enumerates all hits and removes duplicates exactly as a full
+ * run does after reading, so all parts agree on the order of entries and
+ * each one reads only its own share of them.
+ */
+
+static void subbook_part_read(Book_Subbook* subbook, Book_Reader* reader) {
+    subbook_entries_undupe(subbook, reader);
+
+    const int total = subbook->entry_count;
+    const int start = (long long)total * reader->part_index / reader->part_count;
+    const int end = (long long)total * (reader->part_index + 1) / reader->part_count;
+
+    memmove(subbook->entries, subbook->entries + start, (end - start) * sizeof(Book_Entry));
+    subbook->entry_count = end - start;
+    subbook->entry_start = start;
+    subbook->entry_end = end;
+    subbook->entry_total = total;
+
+    trace_begin(reader->trace, "read part", "count", subbook->entry_count);
+    for (int i = 0; i < subbook->entry_count; ++i) {
+        Book_Entry* entry = subbook->entries + i;
+
+        EB_Position heading;
+        heading.page = entry->heading.page;
+        heading.offset = entry->heading.offset;
+
+        EB_Position text;
+        text.page = entry->text.page;
+        text.offset = entry->text.offset;
+
+        subbook_entry_read(subbook, reader, entry, &heading, &text);
+    }
+    trace_end(reader->trace, "read part", NULL, 0);
+}
+
+static int book_bind_subbook(EB_Book* eb_book, const char path[], EB_Subbook_Code subbook_code) {
+    eb_initialize_book(eb_book);
+
+    EB_Error_Code error;
+    if ((error = eb_bind(eb_book, path)) != EB_SUCCESS || (error = eb_set_subbook(eb_book, subbook_code)) != EB_SUCCESS) {
+        fprintf(stderr, "error: failed to bind book (%s)\n", eb_error_message(error));
+        eb_finalize_book(eb_book);
+        return 0;
+    }
+
+    return 1;
+}
+
+/*
+ * With --fonts-used, only the glyphs noted in the used bitset are looked up,
+ * in ascending order of code as a walk over the whole font would find them.
+ */
+
+static void subbook_font_used_import(
+    Book_Glyph_Set* glyph_set,
+    EB_Book*        eb_book,
+    const uint64_t  used[],
+    EB_Error_Code   (*bitmap_read)(EB_Book*, int, char*)
+) {
+    int glyph_alloc = 0;
+    for (int i = 0; i < FONT_CODE_WORDS; ++i) {
+        for (uint64_t bits = used[i]; bits != 0; bits &= bits - 1) {
+            if (glyph_set->count == glyph_alloc) {
+                glyph_alloc = glyph_alloc == 0 ? 64 : glyph_alloc * 2;
+                glyph_set->glyphs = realloc(glyph_set->glyphs, sizeof(Book_Glyph) * glyph_alloc);
+            }
+
+            Book_Glyph* glyph = glyph_set->glyphs + glyph_set->count;
+            glyph->code = i * 64 + __builtin_ctzll(bits);
+            memset(glyph->bitmap, 0, glyph_set->bitmap_size);
+            if (bitmap_read(eb_book, glyph->code, glyph->bitmap) == EB_SUCCESS) {
+                ++glyph_set->count;
+            }
+        }
+    }
+}
+
+static void subbook_font_narrow_import(Book_Glyph_Set* glyph_set, EB_Book* eb_book, EB_Font_Code code, const uint64_t used[]) {
+    switch (code) {
+        case EB_FONT_16:
+            glyph_set->width = EB_WIDTH_NARROW_FONT_16;
+            glyph_set->height = EB_HEIGHT_FONT_16;
+            glyph_set->bitmap_size = EB_SIZE_NARROW_FONT_16;
+            break;
+        case EB_FONT_24:
+            glyph_set->width = EB_WIDTH_NARROW_FONT_24;
+            glyph_set->height = EB_HEIGHT_FONT_24;
+            glyph_set->bitmap_size = EB_SIZE_NARROW_FONT_24;
+            break;
+        case EB_FONT_30:
+            glyph_set->width = EB_WIDTH_NARROW_FONT_30;
+            glyph_set->height = EB_HEIGHT_FONT_30;
+            glyph_set->bitmap_size = EB_SIZE_NARROW_FONT_30;
+            break;
+        case EB_FONT_48:
+            glyph_set->width = EB_WIDTH_NARROW_FONT_48;
+            glyph_set->height = EB_HEIGHT_FONT_48;
+            glyph_set->bitmap_size = EB_SIZE_NARROW_FONT_48;
+            break;
+    }
+
+    if (used != NULL) {
+        subbook_font_used_import(glyph_set, eb_book, used, eb_narrow_font_character_bitmap);
+        return;
+    }
+
+    int font_code = 0;
+    if (eb_narrow_font_start(eb_book, &font_code) != EB_SUCCESS) {
+        return;
+    }
+
+    int glyph_alloc = 256;
+    glyph_set->glyphs = malloc(sizeof(Book_Glyph) * glyph_alloc);
+
+    for (;;) {
+        if (glyph_set->count == glyph_alloc) {
+            glyph_alloc *= 2;
+            glyph_set->glyphs = realloc(glyph_set->glyphs, sizeof(Book_Glyph) * glyph_alloc);
+        }
+
+        Book_Glyph* glyph = glyph_set->glyphs + glyph_set->count;
+        glyph->code = font_code;
+        memset(glyph->bitmap, 0, glyph_set->bitmap_size);
+        if (eb_narrow_font_character_bitmap(eb_book, font_code, glyph->bitmap) != EB_SUCCESS) {
+            break;
+        }
+
+        ++glyph_set->count;
+
+        if (eb_forward_narrow_font_character(eb_book, 1, &font_code) != EB_SUCCESS) {
+            break;
+        }
+    }
+}
+
+static void subbook_font_wide_import(Book_Glyph_Set* glyph_set, EB_Book* eb_book, EB_Font_Code code, const uint64_t used[]) {
+    switch (code) {
+        case EB_FONT_16:
+            glyph_set->width = EB_WIDTH_WIDE_FONT_16;
+            glyph_set->height = EB_HEIGHT_FONT_16;
+            glyph_set->bitmap_size = EB_SIZE_WIDE_FONT_16;
+            break;
+        case EB_FONT_24:
+            glyph_set->width = EB_WIDTH_WIDE_FONT_24;
+            glyph_set->height = EB_HEIGHT_FONT_24;
+            glyph_set->bitmap_size = EB_SIZE_WIDE_FONT_24;
+            break;
+        case EB_FONT_30:
+            glyph_set->width = EB_WIDTH_WIDE_FONT_30;
+            glyph_set->height = EB_HEIGHT_FONT_30;
+            glyph_set->bitmap_size = EB_SIZE_WIDE_FONT_30;
+            break;
+        case EB_FONT_48:
+            glyph_set->width = EB_WIDTH_WIDE_FONT_48;
+            glyph_set->height = EB_HEIGHT_FONT_48;
+            glyph_set->bitmap_size = EB_SIZE_WIDE_FONT_48;
+            break;
+    }
+
+    if (used != NULL) {
+        subbook_font_used_import(glyph_set, eb_book, used, eb_wide_font_character_bitmap);
+        return;
+    }
+
+    int font_code = 0;
+    if (eb_wide_font_start(eb_book, &font_code) != EB_SUCCESS) {
+        return;
+    }
+
+    int glyph_alloc = 256;
+    glyph_set->glyphs = malloc(sizeof(Book_Glyph) * glyph_alloc);
+
+    for (;;) {
+        if (glyph_set->count == glyph_alloc) {
+            glyph_alloc *= 2;
+            glyph_set->glyphs = realloc(glyph_set->glyphs, sizeof(Book_Glyph) * glyph_alloc);
+        }
+
+        Book_Glyph* glyph = glyph_set->glyphs + glyph_set->count;
+        glyph->code = font_code;
+        memset(glyph->bitmap, 0, glyph_set->bitmap_size);
+        if (eb_wide_font_character_bitmap(eb_book, font_code, glyph->bitmap) != EB_SUCCESS) {
+            break;
+        }
+
+        ++glyph_set->count;
+
+        if (eb_forward_wide_font_character(eb_book, 1, &font_code) != EB_SUCCESS) {
+            break;
+        }
+    }
+}
+
+/* Each size and width walks its glyphs with separate iteration state, so each gets a handle of its own. */
+static void subbook_font_import_worker(void* context, int index) {
+    const Book_Font_Job* job = context;
+    const EB_Font_Code codes[] = {EB_FONT_16, EB_FONT_24, EB_FONT_30, EB_FONT_48};
+    const int heights[] = {16, 24, 30, 48};
+    const EB_Font_Code code = codes[index / 2];
+    Book_Font* font = job->subbook->fonts + index / 2;
+
+    if (job->sizes != 0 && !(job->sizes & 1 << index / 2)) {
+        return;
+    }
+
+    EB_Book eb_book;
+    if (!book_bind_subbook(&eb_book, job->path, job->subbook_code)) {
+        return;
+    }
+
+    if (eb_set_font(&eb_book, code) == EB_SUCCESS) {
+        if (index % 2 == 0) {
+            trace_begin(job->trace, "narrow font", "height", heights[index / 2]);
+            subbook_font_narrow_import(&font->narrow, &eb_book, code, job->used);
+            trace_end(job->trace, "narrow font", "glyphs", font->narrow.count);
+        }
+        else {
+            trace_begin(job->trace, "wide font", "height", heights[index / 2]);
+            subbook_font_wide_import(&font->wide, &eb_book, code, job->used != NULL ? job->used + FONT_CODE_WORDS : NULL);
+            trace_end(job->trace, "wide font", "glyphs", font->wide.count);
+        }
+    }
+
+    eb_finalize_book(&eb_book);
+}
+
+static void book_block_glyphs_collect(Book_Block* block, uint64_t used[]) {
+    for (int i = 0; i < block->glyph_count; ++i) {
+        const Hook_Glyph* glyph = block->glyphs + i;
+        if (glyph->code < FONT_CODE_WORDS * 64) {
+            const int word = (glyph->width == GAIJI_WIDE ? FONT_CODE_WORDS : 0) + glyph->code / 64;
+            used[word] |= 1ULL << glyph->code % 64;
+        }
+    }
+
+    free(block->glyphs);
+    block->glyphs = NULL;
+    block->glyph_count = 0;
+}
+
+/*
+ * Marks the glyphs used by the copyright and the entries that were kept, a
+ * bit per code for narrow glyphs followed by wide ones. Entries read for
+ * duplicate hits or rejected by filters were freed already, so their glyphs
+ * are left out just as they are from the output.
+ */
+
+static uint64_t* subbook_glyphs_collect(Book_Subbook* subbook) {
+    uint64_t* used = calloc(FONT_CODE_WORDS * 2, sizeof(uint64_t));
+    book_block_glyphs_collect(&subbook->copyright, used);
+    for (int i = 0; i < subbook->entry_count; ++i) {
+        book_block_glyphs_collect(&subbook->entries[i].heading, used);
+        book_block_glyphs_collect(&subbook->entries[i].text, used);
+    }
+
+    return used;
+}
+
+static void subbook_import(Book_Subbook* subbook, Book_Reader* reader, int flags) {
+    EB_Book* eb_book = reader->book;
+
+    char title[EB_MAX_TITLE_LENGTH + 1];
+    if (eb_subbook_title(eb_book, title) == EB_SUCCESS) {
+        subbook->title = eucjp_to_utf8(title);
+    }
+
+    if (eb_have_copyright(eb_book)) {
+        EB_Position position;
+        if (eb_copyright(eb_book, &position) == EB_SUCCESS) {
+            subbook->copyright = book_read_content(reader, &position, BOOK_MODE_TEXT);
+        }
+    }
+
+    if (flags & FLAG_ENTRIES) {
+        if (eb_search_all_alphabet(eb_book) == EB_SUCCESS) {
+            subbook_entries_import(subbook, reader, "search alphabet");
+        }
+
+        if (eb_search_all_kana(eb_book) == EB_SUCCESS) {
+            subbook_entries_import(subbook, reader, "search kana");
+        }
+
+        if (eb_search_all_asis(eb_book) == EB_SUCCESS) {
+            subbook_entries_import(subbook, reader, "search asis");
+        }
+
+        if (reader->part_count > 0) {
+            subbook_part_read(subbook, reader);
+        }
+        else {
+            subbook_entries_undupe(subbook, reader);
+        }
+
+        stats_count(reader->stats, STATS_COUNTER_UNMATCHED, subbook_unmatched_remove(subbook));
+        stats_count(reader->stats, STATS_COUNTER_ENTRIES, subbook->entry_count);
+    }
+
+    if (flags & FLAG_FONTS) {
+        trace_begin(reader->trace, "fonts", NULL, 0);
+        Book_Font_Job job = {};
+        job.path = reader->path;
+        job.subbook = subbook;
+        uint64_t* used = flags & FLAG_FONTS_USED ? subbook_glyphs_collect(subbook) : NULL;
+        job.used = used;
+        job.sizes = reader->font_sizes;
+        job.trace = reader->trace;
+
+        if (eb_subbook(eb_book, &job.subbook_code) == EB_SUCCESS) {
+            parallel_for(ARRSIZE(subbook->fonts) * 2, reader->threads, subbook_font_import_worker, &job);
+        }
+
+        for (unsigned i = 0; i < ARRSIZE(subbook->fonts); ++i) {
+            const Book_Font* font = subbook->fonts + i;
+            stats_count(reader->stats, STATS_COUNTER_GLYPHS, font->narrow.count + font->wide.count);
+        }
+
+        free(used);
+        trace_end(reader->trace, "fonts", NULL, 0);
+    }
+}
+
+static int book_media_select(EB_Book* eb_book, const Hook_Media* media) {
+    EB_Position start;
+    EB_Position end;
+    start.page = media->args[0];
+    start.offset = media->args[1];
+    end.page = media->args[2];
+    end.offset = media->args[3];
+
+    EB_Error_Code error = EB_SUCCESS;
+    switch (media->type) {
+        case HOOK_MEDIA_COLOR_BMP:
+        case HOOK_MEDIA_COLOR_JPEG:
+            error = eb_set_binary_color_graphic(eb_book, &start);
+            break;
+        case HOOK_MEDIA_WAVE:
+            error = eb_set_binary_wave(eb_book, &start, &end);
+            break;
+        case HOOK_MEDIA_MPEG:
+            error = eb_set_binary_mpeg(eb_book, media->args);
+            break;
+    }
+
+    if (error != EB_SUCCESS) {
+        fprintf(stderr, "error: failed to locate media (%s)\n", eb_error_message(error));
+        return 0;
+    }
+
+    return 1;
+}
+
+/*
+ * Files are named after a hash of their contents, so media shared between
+ * subbooks or repeated across runs is written once. Each worker writes to its
+ * own temporary name first, as two items may turn out to have equal data.
+ */
+
+static char* book_media_write(const Buffer* data, Hook_Media_Type type, const char dir[], int index) {
+    const char* extensions[] = {"bmp", "jpg", "wav", "mpg"};
+
+    const uint64_t hash = hash_xxh64(data->data, data->size, 0);
+    char name[32];
+    snprintf(name, ARRSIZE(name), "%016llx.%s", (unsigned long long)hash, extensions[type]);
+
+    Buffer path = {};
+    buffer_append_string(&path, dir);
+    buffer_append_char(&path, '/');
+    buffer_append_string(&path, name);
+    buffer_append_char(&path, 0);
+
+    FILE* fp = fopen(path.data, "rb");
+    if (fp != NULL) {
+        fclose(fp);
+        buffer_free(&path);
+        return strdup(name);
+    }
+
+    char suffix[32];
+    snprintf(suffix, ARRSIZE(suffix), ".%d.tmp", index);
+
+    Buffer temp_path = {};
+    buffer_append(&temp_path, path.data, path.size - 1);
+    buffer_append_string(&temp_path, suffix);
+    buffer_append_char(&temp_path, 0);
+    const char* temp = temp_path.data;
+
+    int success = 0;
+    if ((fp = fopen(temp, "wb")) != NULL) {
+        success = fwrite(data->data, 1, data->size, fp) == data->size;
+        success = fclose(fp) == 0 && success;
+    }
+
+    if (success && rename(temp, path.data) != 0) {
+        remove(temp);
+        success = (fp = fopen(path.data, "rb")) != NULL;
+        if (success) {
+            fclose(fp);
+        }
+    }
+
+    if (!success) {
+        fprintf(stderr, "error: failed to write media file (%s)\n", path.data);
+        remove(temp);
+    }
+
+    buffer_free(&temp_path);
+    buffer_free(&path);
+    return success ? strdup(name) : NULL;
+}
+
+static void book_media_extract_worker(void* context, int worker) {
+    Book_Media_Job* job = context;
+
+    /* The binary read state lives in the EB_Book, so every worker binds its own. */
+    EB_Book eb_book;
+    if (!book_bind_subbook(&eb_book, job->path, job->subbook_code)) {
+        return;
+    }
+
+    EB_Error_Code error;
+    Buffer data = {};
+    for (int i = worker; i < job->subbook->media_count; i += job->workers) {
+        Book_Media* media = job->subbook->media + i;
+        if (!book_media_select(&eb_book, &media->source)) {
+            continue;
+        }
+
+        trace_begin(job->trace, "media", "index", i);
+        buffer_clear(&data);
+
+        for (;;) {
+            buffer_reserve(&data, READ_CHUNK_SIZE);
+
+            ssize_t size = 0;
+            if ((error = eb_read_binary(&eb_book, READ_CHUNK_SIZE, data.data + data.size, &size)) != EB_SUCCESS) {
+                fprintf(stderr, "error: failed to read media (%s)\n", eb_error_message(error));
+                break;
+            }
+
+            if (size <= 0) {
+                media->file = book_media_write(&data, media->source.type, job->media_path, i);
+                break;
+            }
+
+            data.size += size;
+        }
+
+        trace_end(job->trace, "media", "bytes", data.size);
+    }
+
+    buffer_free(&data);
+    eb_finalize_book(&eb_book);
+}
+
+static void book_media_extract(Book_Subbook* subbook, const char path[], EB_Subbook_Code subbook_code, const Book_Options* options) {
+    subbook_media_collect(subbook);
+
+    Book_Media_Job job = {};
+    job.path = path;
+    job.subbook_code = subbook_code;
+    job.subbook = subbook;
+    job.media_path = options->media_path;
+    job.workers = options->threads < subbook->media_count ? options->threads : subbook->media_count;
+    job.trace = options->trace;
+
+    parallel_for(job.workers, job.workers, book_media_extract_worker, &job);
+    subbook_media_link(subbook);
+
+    for (int i = 0; i < subbook->media_count; ++i) {
+        if (subbook->media[i].file != NULL) {
+            stats_count(options->stats, STATS_COUNTER_MEDIA, 1);
+        }
+    }
+}
+
+/*
+ * Parses lines such as "0 1234 56 text"; the mode may be "text" or "heading"
+ * and defaults to text when omitted.
+ */
+
+static int book_fetches_parse_line(Book* book, char line[]) {
+    char* comment = strchr(line, '#');
+    if (comment != NULL) {
+        *comment = 0;
+    }
+
+    Book_Fetch fetch = {};
+    char mode[16] = "text";
+    char trailing[2];
+
+    const int fields = sscanf(
+        line,
+        "%d %d %d %15s %1s",
+        &fetch.subbook,
+        &fetch.block.page,
+        &fetch.block.offset,
+        mode,
+        trailing
+    );
+
+    if (fields == EOF) {
+        return 1;
+    }
+
+    if (fields < 3 || fields > 4 || fetch.subbook < 0 || fetch.block.page < 0 || fetch.block.offset < 0) {
+        return 0;
+    }
+
+    if (strcmp(mode, "text") == 0) {
+        fetch.mode = BOOK_MODE_TEXT;
+    }
+    else if (strcmp(mode, "heading") == 0) {
+        fetch.mode = BOOK_MODE_HEADING;
+    }
+    else {
+        return 0;
+    }
+
+    if (book->fetch_count == book->fetch_alloc) {
+        book->fetch_alloc *= 2;
+        book->fetches = realloc(book->fetches, book->fetch_alloc * sizeof(Book_Fetch));
+    }
+
+    book->fetches[book->fetch_count++] = fetch;
+    return 1;
+}
+
+static int book_fetches_load(Book* book, const char path[]) {
+    FILE* fp = strcmp(path, "-") == 0 ? stdin : fopen(path, "r");
+    if (fp == NULL) {
+        fprintf(stderr, "error: failed to open fetch list (%s)\n", path);
+        return 0;
+    }
+
+    book->fetch_alloc = 1024;
+    book->fetches = malloc(book->fetch_alloc * sizeof(Book_Fetch));
+
+    char line[256];
+    int line_number = 0;
+    int success = 1;
+    while (success && fgets(line, ARRSIZE(line), fp) != NULL) {
+        ++line_number;
+        if (!book_fetches_parse_line(book, line)) {
+            fprintf(stderr, "error: invalid fetch (%s:%d)\n", path, line_number);
+            success = 0;
+        }
+    }
+
+    if (fp != stdin) {
+        fclose(fp);
+    }
+
+    return success;
+}
+
+static int book_fetch_compare(const void* a, const void* b) {
+    const Book_Fetch* x = *(const Book_Fetch* const*)a;
+    const Book_Fetch* y = *(const Book_Fetch* const*)b;
+
+    if (x->subbook != y->subbook) {
+        return x->subbook < y->subbook ? -1 : 1;
+    }
+
+    if (x->block.page != y->block.page) {
+        return x->block.page < y->block.page ? -1 : 1;
+    }
+
+    if (x->block.offset != y->block.offset) {
+        return x->block.offset < y->block.offset ? -1 : 1;
+    }
+
+    return 0;
+}
+
+static void book_fetches_import(Book* book, Book_Reader* reader, const EB_Subbook_Code sub_codes[]) {
+    /* Reads are made in position order so the book is scanned front to back. */
+    Book_Fetch** order = malloc(book->fetch_count * sizeof(Book_Fetch*));
+    for (int i = 0; i < book->fetch_count; ++i) {
+        order[i] = book->fetches + i;
+    }
+
+    qsort(order, book->fetch_count, sizeof(Book_Fetch*), book_fetch_compare);
+
+    int subbook_current = -1;
+    int subbook_valid = 0;
+    for (int i = 0; i < book->fetch_count; ++i) {
+        Book_Fetch* fetch = order[i];
+
+        if (fetch->subbook != subbook_current) {
+            subbook_current = fetch->subbook;
+            subbook_valid = 0;
+
+            EB_Error_Code error;
+            if (subbook_current >= book->subbook_count) {
+                fprintf(stderr, "error: invalid fetch subbook (%d)\n", subbook_current);
+            }
+            else if ((error = eb_set_subbook(reader->book, sub_codes[subbook_current])) != EB_SUCCESS) {
+                fprintf(stderr, "error: failed to set subbook (%s)\n", eb_error_message(error));
+            }
+            else {
+                subbook_valid = 1;
+            }
+        }
+
+        if (subbook_valid) {
+            EB_Position position;
+            position.page = fetch->block.page;
+            position.offset = fetch->block.offset;
+            fetch->block = book_read_content(reader, &position, fetch->mode);
         }
     }
-    while (hit_count > 0);
+
+    free(order);
 }
 
-static void subbook_font_import(Book_Font* font, EB_Book* eb_book, EB_Font_Code code) {
-    if (eb_set_font(eb_book, code) != EB_SUCCESS) {
-        return;
+/*
+ * Saving and loading parts. Values are stored as little endian 32-bit words
+ * and strings with their size plus one, or zero for NULL, so a part can be
+ * merged on any machine.
+ */
+
+static void part_flush(Part_Writer* part) {
+    part->success = writer_write(part->writer, part->buffer.data, part->buffer.size) && part->success;
+    buffer_clear(&part->buffer);
+}
+
+static void part_put_bytes(Part_Writer* part, const char data[], size_t size) {
+    buffer_append(&part->buffer, data, size);
+    if (part->buffer.size >= EXPORT_FLUSH_SIZE) {
+        part_flush(part);
     }
+}
 
-    do {
-        Book_Glyph_Set* glyph_set = &font->narrow;
-        switch (code) {
-            case EB_FONT_16:
-                glyph_set->width = EB_WIDTH_NARROW_FONT_16;
-                glyph_set->height = EB_HEIGHT_FONT_16;
-                glyph_set->bitmap_size = EB_SIZE_NARROW_FONT_16;
-                break;
-            case EB_FONT_24:
-                glyph_set->width = EB_WIDTH_NARROW_FONT_24;
-                glyph_set->height = EB_HEIGHT_FONT_24;
-                glyph_set->bitmap_size = EB_SIZE_NARROW_FONT_24;
-                break;
-            case EB_FONT_30:
-                glyph_set->width = EB_WIDTH_NARROW_FONT_30;
-                glyph_set->height = EB_HEIGHT_FONT_30;
-                glyph_set->bitmap_size = EB_SIZE_NARROW_FONT_30;
-                break;
-            case EB_FONT_48:
-                glyph_set->width = EB_WIDTH_NARROW_FONT_48;
-                glyph_set->height = EB_HEIGHT_FONT_48;
-                glyph_set->bitmap_size = EB_SIZE_NARROW_FONT_48;
-                break;
+static void part_put_int(Part_Writer* part, unsigned int value) {
+    const char data[4] = {value, value >> 8, value >> 16, value >> 24};
+    part_put_bytes(part, data, sizeof(data));
+}
+
+static void part_put_string(Part_Writer* part, const char text[]) {
+    if (text == NULL) {
+        part_put_int(part, 0);
+    }
+    else {
+        const size_t size = strlen(text);
+        part_put_int(part, size + 1);
+        part_put_bytes(part, text, size);
+    }
+}
+
+static void part_put_block(Part_Writer* part, const Book_Block* block) {
+    part_put_string(part, block->text);
+    part_put_string(part, block->key);
+    part_put_int(part, block->page);
+    part_put_int(part, block->offset);
+
+    part_put_int(part, block->span_count);
+    for (int i = 0; i < block->span_count; ++i) {
+        const Hook_Span* span = block->spans + i;
+        part_put_string(part, span->type);
+        part_put_string(part, span->group);
+        part_put_int(part, span->start);
+        part_put_int(part, span->end);
+        part_put_int(part, span->attr_count);
+        for (int j = 0; j < span->attr_count; ++j) {
+            part_put_string(part, span->attrs[j].name);
+            part_put_int(part, span->attrs[j].value);
         }
+    }
 
-        int font_code = 0;
-        if (eb_narrow_font_start(eb_book, &font_code) != EB_SUCCESS) {
-            break;
+    part_put_int(part, block->reference_count);
+    for (int i = 0; i < block->reference_count; ++i) {
+        part_put_int(part, block->references[i].page);
+        part_put_int(part, block->references[i].offset);
+    }
+
+    part_put_int(part, block->media_count);
+    for (int i = 0; i < block->media_count; ++i) {
+        const Book_Media_Ref* ref = block->media + i;
+        part_put_int(part, ref->source.type);
+        for (unsigned j = 0; j < ARRSIZE(ref->source.args); ++j) {
+            part_put_int(part, ref->source.args[j]);
         }
+        part_put_int(part, ref->media);
+    }
+}
+
+static void part_put_glyph_set(Part_Writer* part, const Book_Glyph_Set* glyph_set) {
+    part_put_int(part, glyph_set->bitmap_size);
+    part_put_int(part, glyph_set->width);
+    part_put_int(part, glyph_set->height);
+    part_put_int(part, glyph_set->count);
+    for (int i = 0; i < glyph_set->count; ++i) {
+        part_put_int(part, glyph_set->glyphs[i].code);
+        part_put_bytes(part, glyph_set->glyphs[i].bitmap, glyph_set->bitmap_size);
+    }
+}
 
-        int glyph_alloc = 256;
-        glyph_set->glyphs = malloc(sizeof(Book_Glyph) * glyph_alloc);
+static void part_get_bytes(Part_Reader* part, char data[], size_t size) {
+    if (part->success && gzread(part->file, data, size) != (int)size) {
+        part->success = 0;
+    }
 
-        for (;;) {
-            if (glyph_set->count == glyph_alloc) {
-                glyph_alloc *= 2;
-                glyph_set->glyphs = realloc(glyph_set->glyphs, sizeof(Book_Glyph) * glyph_alloc);
-            }
+    if (!part->success) {
+        memset(data, 0, size);
+    }
+}
 
-            Book_Glyph* glyph = glyph_set->glyphs + glyph_set->count;
-            glyph->code = font_code;
-            memset(glyph->bitmap, 0, glyph_set->bitmap_size);
-            if (eb_narrow_font_character_bitmap(eb_book, font_code, glyph->bitmap) != EB_SUCCESS) {
-                break;
-            }
+static unsigned int part_get_int(Part_Reader* part) {
+    unsigned char data[4];
+    part_get_bytes(part, (char*)data, sizeof(data));
+    return data[0] | data[1] << 8 | data[2] << 16 | (unsigned int)data[3] << 24;
+}
+
+/* Counts are checked before they size an allocation, so a damaged part fails instead of exhausting memory. */
+static int part_get_count(Part_Reader* part, int limit) {
+    const int count = part_get_int(part);
+    if (count < 0 || count > limit) {
+        part->success = 0;
+        return 0;
+    }
 
-            ++glyph_set->count;
+    return count;
+}
 
-            if (eb_forward_narrow_font_character(eb_book, 1, &font_code) != EB_SUCCESS) {
-                break;
+static char* part_get_string(Part_Reader* part) {
+    const int size = part_get_count(part, INT_MAX);
+    if (size == 0) {
+        return NULL;
+    }
+
+    char* text = malloc(size);
+    part_get_bytes(part, text, size - 1);
+    text[size - 1] = 0;
+    return text;
+}
+
+static const char* part_get_span_name(Part_Reader* part) {
+    char* name = part_get_string(part);
+    const char* span_name = name != NULL ? hooks_span_name(name) : NULL;
+    if (span_name == NULL) {
+        part->success = 0;
+    }
+
+    free(name);
+    return span_name;
+}
+
+static Book_Block part_get_block(Part_Reader* part) {
+    Book_Block block = {};
+    block.text = part_get_string(part);
+    block.key = part_get_string(part);
+    block.page = part_get_int(part);
+    block.offset = part_get_int(part);
+
+    if ((block.span_count = part_get_count(part, INT_MAX / sizeof(Hook_Span))) > 0) {
+        block.spans = calloc(block.span_count, sizeof(Hook_Span));
+        for (int i = 0; i < block.span_count; ++i) {
+            Hook_Span* span = block.spans + i;
+            span->type = part_get_span_name(part);
+            span->group = part_get_span_name(part);
+            span->start = part_get_int(part);
+            span->end = part_get_int(part);
+            span->attr_count = part_get_count(part, HOOK_SPAN_MAX_ATTRS);
+            for (int j = 0; j < span->attr_count; ++j) {
+                span->attrs[j].name = part_get_span_name(part);
+                span->attrs[j].value = part_get_int(part);
             }
         }
     }
-    while (0);
 
-    do {
-        Book_Glyph_Set* glyph_set = &font->wide;
-        switch (code) {
-            case EB_FONT_16:
-                glyph_set->width = EB_WIDTH_WIDE_FONT_16;
-                glyph_set->height = EB_HEIGHT_FONT_16;
-                glyph_set->bitmap_size = EB_SIZE_WIDE_FONT_16;
-                break;
-            case EB_FONT_24:
-                glyph_set->width = EB_WIDTH_WIDE_FONT_24;
-                glyph_set->height = EB_HEIGHT_FONT_24;
-                glyph_set->bitmap_size = EB_SIZE_WIDE_FONT_24;
-                break;
-            case EB_FONT_30:
-                glyph_set->width = EB_WIDTH_WIDE_FONT_30;
-                glyph_set->height = EB_HEIGHT_FONT_30;
-                glyph_set->bitmap_size = EB_SIZE_WIDE_FONT_30;
-                break;
-            case EB_FONT_48:
-                glyph_set->width = EB_WIDTH_WIDE_FONT_48;
-                glyph_set->height = EB_HEIGHT_FONT_48;
-                glyph_set->bitmap_size = EB_SIZE_WIDE_FONT_48;
-                break;
+    if ((block.reference_count = part_get_count(part, INT_MAX / sizeof(Book_Reference))) > 0) {
+        block.references = calloc(block.reference_count, sizeof(Book_Reference));
+        for (int i = 0; i < block.reference_count; ++i) {
+            block.references[i].page = part_get_int(part);
+            block.references[i].offset = part_get_int(part);
+            block.references[i].entry = -1;
         }
+    }
 
-        int font_code = 0;
-        if (eb_wide_font_start(eb_book, &font_code) != EB_SUCCESS) {
-            break;
+    if ((block.media_count = part_get_count(part, INT_MAX / sizeof(Book_Media_Ref))) > 0) {
+        block.media = calloc(block.media_count, sizeof(Book_Media_Ref));
+        for (int i = 0; i < block.media_count; ++i) {
+            Book_Media_Ref* ref = block.media + i;
+            ref->source.type = part_get_count(part, HOOK_MEDIA_MPEG);
+            for (unsigned j = 0; j < ARRSIZE(ref->source.args); ++j) {
+                ref->source.args[j] = part_get_int(part);
+            }
+            ref->media = part_get_int(part);
         }
+    }
 
-        int glyph_alloc = 256;
-        glyph_set->glyphs = malloc(sizeof(Book_Glyph) * glyph_alloc);
+    return block;
+}
 
-        for (;;) {
-            if (glyph_set->count == glyph_alloc) {
-                glyph_alloc *= 2;
-                glyph_set->glyphs = realloc(glyph_set->glyphs, sizeof(Book_Glyph) * glyph_alloc);
-            }
+static void part_get_glyph_set(Part_Reader* part, Book_Glyph_Set* glyph_set) {
+    glyph_set->bitmap_size = part_get_count(part, EB_SIZE_WIDE_FONT_48);
+    glyph_set->width = part_get_int(part);
+    glyph_set->height = part_get_int(part);
+    glyph_set->count = part_get_count(part, INT_MAX / sizeof(Book_Glyph));
+    glyph_set->glyphs = NULL;
+
+    if (glyph_set->count > 0) {
+        glyph_set->glyphs = calloc(glyph_set->count, sizeof(Book_Glyph));
+        for (int i = 0; i < glyph_set->count; ++i) {
+            glyph_set->glyphs[i].code = part_get_int(part);
+            part_get_bytes(part, glyph_set->glyphs[i].bitmap, glyph_set->bitmap_size);
+        }
+    }
+}
 
-            Book_Glyph* glyph = glyph_set->glyphs + glyph_set->count;
-            glyph->code = font_code;
-            memset(glyph->bitmap, 0, glyph_set->bitmap_size);
-            if (eb_wide_font_character_bitmap(eb_book, font_code, glyph->bitmap) != EB_SUCCESS) {
-                break;
-            }
+static int part_header_read(Part_Reader* part, Part_Header* header) {
+    char magic[sizeof(PART_MAGIC) - 1];
+    part_get_bytes(part, magic, sizeof(magic));
+    if (memcmp(magic, PART_MAGIC, sizeof(magic)) != 0 || part_get_int(part) != PART_VERSION) {
+        return 0;
+    }
 
-            ++glyph_set->count;
+    header->index = part_get_int(part);
+    header->count = part_get_int(part);
+    header->flags = part_get_int(part);
+    header->sort = part_get_int(part);
 
-            if (eb_forward_wide_font_character(eb_book, 1, &font_code) != EB_SUCCESS) {
-                break;
+    return part->success && header->count > 0 && header->index >= 0 && header->index < header->count;
+}
+
+/*
+ * Parts are loaded in order; every part must pick up each subbook where the
+ * previous one left off. The title, copyright and fonts come from the first.
+ */
+
+/*
+ * Adds the glyphs of one part to those of the parts before it. Only the first
+ * part reads fonts unless --fonts-used is given, in which case each part has
+ * the glyphs its own entries use, and glyphs used by several parts are kept
+ * once. Both sets are in ascending order of code.
+ */
+
+static void glyph_set_merge(Book_Glyph_Set* glyph_set, Book_Glyph_Set* other) {
+    if (glyph_set->glyphs == NULL) {
+        *glyph_set = *other;
+        return;
+    }
+
+    if (other->count == 0) {
+        free(other->glyphs);
+        return;
+    }
+
+    Book_Glyph* glyphs = malloc((glyph_set->count + other->count) * sizeof(Book_Glyph));
+    int count = 0;
+    for (int i = 0, j = 0; i < glyph_set->count || j < other->count;) {
+        if (j == other->count || (i < glyph_set->count && glyph_set->glyphs[i].code < other->glyphs[j].code)) {
+            glyphs[count++] = glyph_set->glyphs[i++];
+        }
+        else {
+            if (i < glyph_set->count && glyph_set->glyphs[i].code == other->glyphs[j].code) {
+                ++i;
             }
+
+            glyphs[count++] = other->glyphs[j++];
         }
     }
-    while (0);
+
+    free(glyph_set->glyphs);
+    free(other->glyphs);
+    glyph_set->glyphs = glyphs;
+    glyph_set->count = count;
 }
 
-static void subbook_import(Book_Subbook* subbook, EB_Book* eb_book, EB_Hookset* eb_hookset, int flags) {
-    char title[EB_MAX_TITLE_LENGTH + 1];
-    if (eb_subbook_title(eb_book, title) == EB_SUCCESS) {
-        subbook->title = eucjp_to_utf8(title);
+static void part_load(Book* book, Part_Reader* part, int index) {
+    char* char_code = part_get_string(part);
+    char* disc_code = part_get_string(part);
+    if (index == 0 && char_code != NULL && disc_code != NULL) {
+        snprintf(book->char_code, sizeof(book->char_code), "%s", char_code);
+        snprintf(book->disc_code, sizeof(book->disc_code), "%s", disc_code);
     }
 
-    if (eb_have_copyright(eb_book)) {
-        EB_Position position;
-        if (eb_copyright(eb_book, &position) == EB_SUCCESS) {
-            subbook->copyright = book_read_content(eb_book, eb_hookset, &position, BOOK_MODE_TEXT);
-        }
+    free(char_code);
+    free(disc_code);
+
+    const int subbook_count = part_get_count(part, EB_MAX_SUBBOOKS);
+    if (index == 0 && part->success) {
+        book->subbook_count = subbook_count;
+        book->subbooks = calloc(subbook_count + 1, sizeof(Book_Subbook));
+    }
+    else if (subbook_count != book->subbook_count) {
+        part->success = 0;
     }
 
-    if (flags & FLAG_ENTRIES) {
-        if (eb_search_all_alphabet(eb_book) == EB_SUCCESS) {
-            subbook_entries_import(subbook, eb_book, eb_hookset);
+    for (int i = 0; i < book->subbook_count && part->success; ++i) {
+        Book_Subbook* subbook = book->subbooks + i;
+
+        char* title = part_get_string(part);
+        Book_Block copyright = part_get_block(part);
+        if (index == 0) {
+            subbook->title = title;
+            subbook->copyright = copyright;
+        }
+        else {
+            free(title);
+            book_block_free(&copyright);
         }
 
-        if (eb_search_all_kana(eb_book) == EB_SUCCESS) {
-            subbook_entries_import(subbook, eb_book, eb_hookset);
+        const int entry_start = part_get_int(part);
+        const int entry_end = part_get_int(part);
+        const int entry_total = part_get_count(part, INT_MAX / sizeof(Book_Entry));
+        const int entry_count = part_get_count(part, entry_total);
+        if (index == 0 && part->success) {
+            subbook->entry_total = entry_total;
+            subbook->entry_alloc = entry_total > 0 ? entry_total : 1;
+            subbook->entries = malloc(subbook->entry_alloc * sizeof(Book_Entry));
         }
 
-        if (eb_search_all_asis(eb_book) == EB_SUCCESS) {
-            subbook_entries_import(subbook, eb_book, eb_hookset);
+        /* Parts cover consecutive ranges of entries, of which filters may have left out some. */
+        if (
+            entry_start != subbook->entry_end ||
+            entry_end < entry_start ||
+            entry_end > entry_total ||
+            entry_total != subbook->entry_total ||
+            entry_count > entry_end - entry_start
+        ) {
+            part->success = 0;
+            break;
         }
-    }
 
-    if (flags & FLAG_FONTS) {
-        const EB_Font_Code codes[] = {EB_FONT_16, EB_FONT_24, EB_FONT_30, EB_FONT_48};
-        for (unsigned i = 0; i < ARRSIZE(codes); ++i) {
-            subbook_font_import(subbook->fonts + i, eb_book, codes[i]);
+        subbook->entry_end = entry_end;
+
+        const int media_base = subbook->media_count;
+        const int media_count = part_get_count(part, INT_MAX / sizeof(Book_Media) - media_base);
+        if (media_count > 0) {
+            subbook->media = realloc(subbook->media, (media_base + media_count) * sizeof(Book_Media));
+            for (int j = 0; j < media_count; ++j) {
+                Book_Media* media = subbook->media + subbook->media_count++;
+                memset(&media->source, 0, sizeof(Hook_Media));
+                media->file = part_get_string(part);
+            }
+        }
+
+        for (unsigned j = 0; j < ARRSIZE(subbook->fonts); ++j) {
+            Book_Font font;
+            part_get_glyph_set(part, &font.narrow);
+            part_get_glyph_set(part, &font.wide);
+            glyph_set_merge(&subbook->fonts[j].narrow, &font.narrow);
+            glyph_set_merge(&subbook->fonts[j].wide, &font.wide);
+        }
+
+        for (int j = 0; j < entry_count && part->success; ++j) {
+            Book_Entry* entry = subbook->entries + subbook->entry_count++;
+            entry->heading = part_get_block(part);
+            entry->text = part_get_block(part);
+
+            for (int k = 0; k < entry->text.media_count; ++k) {
+                Book_Media_Ref* ref = entry->text.media + k;
+                if (ref->media >= media_count) {
+                    part->success = 0;
+                }
+                else if (ref->media >= 0) {
+                    ref->media += media_base;
+                }
+            }
         }
     }
 }
@@ -530,12 +2577,12 @@ void book_destroy(Book* book) {
     for (int i = 0; i < book->subbook_count; ++i) {
         Book_Subbook* subbook = book->subbooks + i;
         free(subbook->title);
-        free(subbook->copyright.text);
+        book_block_free(&subbook->copyright);
 
         for (int j = 0; j < subbook->entry_count; ++j) {
             Book_Entry* entry = subbook->entries + j;
-            free(entry->heading.text);
-            free(entry->text.text);
+            book_block_free(&entry->heading);
+            book_block_free(&entry->text);
         }
 
         for (unsigned j = 0; j < ARRSIZE(subbook->fonts); ++j) {
@@ -544,28 +2591,168 @@ void book_destroy(Book* book) {
             free(font->wide.glyphs);
         }
 
+        for (int j = 0; j < subbook->media_count; ++j) {
+            free(subbook->media[j].file);
+        }
+
+        free(subbook->media);
         free(subbook->entries);
+        intern_pool_free(&subbook->strings);
+    }
+
+    for (int i = 0; i < book->fetch_count; ++i) {
+        book_block_free(&book->fetches[i].block);
     }
 
+    free(book->fetches);
+
     memset(book, 0, sizeof(Book));
 }
 
-int book_export(FILE* fp, const Book* book, int flags) {
+/*
+ * Every json_t made during export comes from a pool: the document skeleton
+ * from one owned by the calling thread, and entries from one per chunk that
+ * is reset as soon as the chunk is written. Frees are ignored while a pool is
+ * bound, and the pools are released whole instead of walking the tree with
+ * json_decref.
+ *
+ * Between the two json_set_alloc_funcs calls no json_t may be freed by
+ * anything but the export itself, and none made inside may outlive it: its
+ * memory, or the header in front of it, goes away with the pools.
+ */
+
+int book_export(Writer* writer, const Book* book, const Book_Options* options) {
+    Pool pool = {};
+    s_export_pool = &pool;
+    json_set_alloc_funcs(export_json_malloc, export_json_free);
+
+    trace_begin(options->trace, "encode", NULL, 0);
+    const Stats_Clock clock = stats_begin(options->stats);
     json_t* book_json = json_object();
-    book_encode(book_json, book, flags);
+    book_encode(book_json, book, options->flags);
+    stats_end(options->stats, STATS_PHASE_ENCODE, &clock);
+    trace_end(options->trace, "encode", NULL, 0);
+
+    Export export;
+    export_init(&export, writer, book, options);
+
+    json_t* subbook_json_array = json_object_get(book_json, "subbooks");
+    for (int i = 0; i < book->subbook_count; ++i) {
+        json_t* subbook_json = json_array_get(subbook_json_array, i);
+        export.entry_arrays[i] = json_object_get(subbook_json, "entries");
+        export.string_arrays[i] = json_object_get(subbook_json, "strings");
+    }
+
+    export_value(&export, book_json, 0);
+    export_finish(&export);
+
+    s_export_pool = NULL;
+    json_set_alloc_funcs(malloc, free);
+    stats_count(options->stats, STATS_COUNTER_JSON_ALLOCATIONS, pool.allocations);
+    pool_free(&pool);
+
+    return export.success;
+}
+
+/*
+ * Entries are written to shard files, each a complete document holding a
+ * slice of the entries; the manifest written to the given writer carries the
+ * rest of the book along with the contents of every shard.
+ */
+
+int book_export_shards(Writer* writer, const Book* book, const Book_Options* options, Writer_Compress compress) {
+    Pool pool = {};
+    s_export_pool = &pool;
+    json_set_alloc_funcs(export_json_malloc, export_json_free);
+
+    int shard_count = 0;
+    Export_Range* ranges = shard_plan(book, options, &shard_count);
+
+    int success = 1;
+    json_t* shard_json_array = json_array();
+    for (int i = 0; i < shard_count && success; ++i) {
+        char* path = shard_path(options->shard_prefix, i, compress);
+        FILE* fp = fopen(path, "wb");
+        if (fp == NULL) {
+            fprintf(stderr, "error: failed to open shard file (%s)\n", path);
+            free(path);
+            success = 0;
+            break;
+        }
+
+        trace_begin(options->trace, "shard", "index", i);
+        Writer* shard_writer = writer_create(fp, compress, options->threads);
 
-    char* output = json_dumps(book_json, flags & FLAG_PRETTY_PRINT ? JSON_INDENT(4) : JSON_COMPACT);
-    if (output != NULL) {
-        fputs(output, fp);
+        const Export_Range* shard_ranges = ranges + i * book->subbook_count;
+
+        Export export;
+        export_init(&export, shard_writer, book, options);
+        memcpy(export.ranges, shard_ranges, book->subbook_count * sizeof(Export_Range));
+        if (options->flags & FLAG_INTERN) {
+            for (int j = 0; j < book->subbook_count; ++j) {
+                if (shard_ranges[j].count > 0) {
+                    shard_strings_select(export.strings + j, book->subbooks + j, shard_ranges + j);
+                }
+            }
+        }
+
+        json_t* shard_json = json_object();
+        shard_encode(shard_json, &export, i, shard_count);
+        export_value(&export, shard_json, 0);
+        export_finish(&export);
+
+        success = export.success && writer_finish(shard_writer);
+        writer_destroy(shard_writer);
+        if (fclose(fp) != 0) {
+            success = 0;
+        }
+
+        if (!success) {
+            fprintf(stderr, "error: failed to write shard file (%s)\n", path);
+        }
+
+        json_array_append_new(shard_json_array, shard_manifest_encode(path, shard_ranges, book->subbook_count, export.bytes));
+        trace_end(options->trace, "shard", "bytes", export.bytes);
+        free(path);
+    }
+
+    if (success) {
+        json_t* book_json = json_object();
+        book_encode(book_json, book, options->flags & ~FLAG_ENTRIES);
+
+        json_t* subbook_json_array = json_object_get(book_json, "subbooks");
+        for (int i = 0; i < book->subbook_count; ++i) {
+            json_t* subbook_json = json_array_get(subbook_json_array, i);
+            json_object_set_new(subbook_json, "entryCount", json_integer(book->subbooks[i].entry_count));
+        }
+
+        json_object_set_new(book_json, "shards", shard_json_array);
+
+        Export export;
+        export_init(&export, writer, book, options);
+        export_value(&export, book_json, 0);
+        export_finish(&export);
+        success = export.success;
     }
-    free(output);
 
-    json_decref(book_json);
-    return output != NULL;
+    free(ranges);
+
+    s_export_pool = NULL;
+    json_set_alloc_funcs(malloc, free);
+    stats_count(options->stats, STATS_COUNTER_JSON_ALLOCATIONS, pool.allocations);
+    pool_free(&pool);
+
+    return success;
 }
 
 
-int book_import(Book* book, const char path[], int flags) {
+int book_import(Book* book, const char path[], const Book_Options* options) {
+    const int flags = options->flags;
+
+    if (options->fetch_path != NULL && !book_fetches_load(book, options->fetch_path)) {
+        return 0;
+    }
+
     EB_Error_Code error;
     if ((error = eb_initialize_library()) != EB_SUCCESS) {
         fprintf(stderr, "error: failed to initialize library (%s)\n", eb_error_message(error));
@@ -579,8 +2766,41 @@ int book_import(Book* book, const char path[], int flags) {
     eb_initialize_hookset(&eb_hookset);
     hooks_install(&eb_hookset, flags);
 
-    if ((error = eb_bind(&eb_book, path)) != EB_SUCCESS) {
+    Book_Reader reader = {};
+    reader.book = &eb_book;
+    reader.hookset = &eb_hookset;
+    reader.path = path;
+    reader.flags = flags;
+    reader.threads = options->threads;
+    reader.part_index = options->part_index;
+    reader.part_count = options->part_count;
+    reader.match_heading = options->match_heading;
+    reader.match_text = options->match_text;
+    reader.font_sizes = options->font_sizes;
+    reader.context.flags = flags;
+    reader.stats = options->stats;
+    reader.trace = options->trace;
+
+    if (options->gaiji_map_path != NULL) {
+        if ((reader.context.gaiji_map = gaiji_map_load(options->gaiji_map_path)) == NULL) {
+            eb_finalize_book(&eb_book);
+            eb_finalize_hookset(&eb_hookset);
+            eb_finalize_library();
+            return 0;
+        }
+    }
+
+    trace_begin(options->trace, "bind", NULL, 0);
+    const Stats_Clock clock = stats_begin(options->stats);
+    error = eb_bind(&eb_book, path);
+    stats_end(options->stats, STATS_PHASE_BIND, &clock);
+    trace_end(options->trace, "bind", NULL, 0);
+
+    if (error != EB_SUCCESS) {
         fprintf(stderr, "error: failed to bind book (%s)\n", eb_error_message(error));
+        if (reader.context.gaiji_map != NULL) {
+            gaiji_map_destroy(reader.context.gaiji_map);
+        }
         eb_finalize_book(&eb_book);
         eb_finalize_hookset(&eb_hookset);
         eb_finalize_library();
@@ -632,23 +2852,218 @@ int book_import(Book* book, const char path[], int flags) {
             book->subbooks = calloc(book->subbook_count, sizeof(Book_Subbook));
             for (int i = 0; i < book->subbook_count; ++i) {
                 Book_Subbook* subbook = book->subbooks + i;
+                stats_select(options->stats, i);
+                trace_begin(options->trace, "subbook", "index", i);
+                const Cache_Counts counts = cache_counts();
                 if ((error = eb_set_subbook(&eb_book, sub_codes[i])) == EB_SUCCESS) {
-                    subbook_import(subbook, &eb_book, &eb_hookset, flags);
+                    /* Fonts are the same for every part, so only the first one reads them, unless each part reads the glyphs it uses. */
+                    const int part_fonts = options->part_index == 0 || (flags & FLAG_FONTS_USED);
+                    subbook_import(subbook, &reader, part_fonts ? flags : flags & ~FLAG_FONTS);
+                    if (flags & FLAG_MEDIA) {
+                        book_media_extract(subbook, path, sub_codes[i], options);
+                    }
                 }
                 else {
                     fprintf(stderr, "error: failed to set subbook (%s)\n", eb_error_message(error));
                 }
+
+                const Cache_Counts counts_end = cache_counts();
+                stats_count(options->stats, STATS_COUNTER_SLICE_HITS, counts_end.hits - counts.hits);
+                stats_count(options->stats, STATS_COUNTER_SLICE_MISSES, counts_end.misses - counts.misses);
+                trace_end(options->trace, "subbook", "entries", subbook->entry_count);
             }
         }
+
+        if (book->fetches != NULL) {
+            stats_select(options->stats, -1);
+            trace_begin(options->trace, "fetch", "count", book->fetch_count);
+            book_fetches_import(book, &reader, sub_codes);
+            trace_end(options->trace, "fetch", NULL, 0);
+        }
     }
     else {
         fprintf(stderr, "error: failed to get subbook list (%s)\n", eb_error_message(error));
     }
 
+    if (reader.context.gaiji_map != NULL) {
+        gaiji_map_report(reader.context.gaiji_map, stderr);
+        gaiji_map_destroy(reader.context.gaiji_map);
+    }
+
+    hooks_context_free(&reader.context);
+    buffer_free(&reader.text);
     eb_finalize_book(&eb_book);
     eb_finalize_hookset(&eb_hookset);
     eb_finalize_library();
 
-    book_undupe(book);
+    stats_select(options->stats, -1);
+
+    /* Sorting, references and string ids span the whole book, so parts leave them to book_merge. */
+    if (options->part_count == 0) {
+        book_finish(book, options);
+    }
+
+    return 1;
+}
+
+/*
+ * Writes what a part read in place of the JSON document; sorting, reference
+ * resolution and string ids are left to book_merge, which sees every entry.
+ */
+
+int book_export_part(Writer* writer, const Book* book, const Book_Options* options) {
+    Part_Writer part = {};
+    part.writer = writer;
+    part.success = 1;
+
+    trace_begin(options->trace, "write part", NULL, 0);
+    part_put_bytes(&part, PART_MAGIC, sizeof(PART_MAGIC) - 1);
+    part_put_int(&part, PART_VERSION);
+    part_put_int(&part, options->part_index);
+    part_put_int(&part, options->part_count);
+    part_put_int(&part, options->flags);
+    part_put_int(&part, options->sort);
+    part_put_string(&part, book->char_code);
+    part_put_string(&part, book->disc_code);
+
+    part_put_int(&part, book->subbook_count);
+    for (int i = 0; i < book->subbook_count; ++i) {
+        const Book_Subbook* subbook = book->subbooks + i;
+        part_put_string(&part, subbook->title);
+        part_put_block(&part, &subbook->copyright);
+        part_put_int(&part, subbook->entry_start);
+        part_put_int(&part, subbook->entry_end);
+        part_put_int(&part, subbook->entry_total);
+        part_put_int(&part, subbook->entry_count);
+
+        part_put_int(&part, subbook->media_count);
+        for (int j = 0; j < subbook->media_count; ++j) {
+            part_put_string(&part, subbook->media[j].file);
+        }
+
+        for (unsigned j = 0; j < ARRSIZE(subbook->fonts); ++j) {
+            part_put_glyph_set(&part, &subbook->fonts[j].narrow);
+            part_put_glyph_set(&part, &subbook->fonts[j].wide);
+        }
+
+        for (int j = 0; j < subbook->entry_count; ++j) {
+            part_put_block(&part, &subbook->entries[j].heading);
+            part_put_block(&part, &subbook->entries[j].text);
+        }
+    }
+
+    part_flush(&part);
+    buffer_free(&part.buffer);
+    trace_end(options->trace, "write part", NULL, 0);
+
+    return part.success;
+}
+
+/*
+ * Loads the parts written by book_export_part, in any order, and finishes the
+ * book as book_import would have. The flags and sort order the parts were
+ * made with replace those in the options, apart from pretty printing.
+ */
+
+int book_merge(Book* book, char* const paths[], int path_count, Book_Options* options) {
+    int* order = malloc(path_count * sizeof(int));
+    memset(order, 0xff, path_count * sizeof(int));
+
+    int success = 1;
+    Part_Header first = {};
+    for (int i = 0; i < path_count && success; ++i) {
+        Part_Reader part = {};
+        part.success = 1;
+        if ((part.file = gzopen(paths[i], "rb")) == NULL) {
+            fprintf(stderr, "error: failed to open part file (%s)\n", paths[i]);
+            success = 0;
+            break;
+        }
+
+        Part_Header header = {};
+        if (!part_header_read(&part, &header)) {
+            fprintf(stderr, "error: invalid part file (%s)\n", paths[i]);
+            success = 0;
+        }
+        else if (i == 0) {
+            first = header;
+        }
+
+        if (success && (header.count != path_count || header.flags != first.flags || header.sort != first.sort)) {
+            fprintf(stderr, "error: part file does not match the others (%s)\n", paths[i]);
+            success = 0;
+        }
+        else if (success && order[header.index] >= 0) {
+            fprintf(stderr, "error: part %d was given twice (%s)\n", header.index, paths[i]);
+            success = 0;
+        }
+        else if (success) {
+            order[header.index] = i;
+        }
+
+        gzclose(part.file);
+    }
+
+    trace_begin(options->trace, "merge", "parts", path_count);
+    for (int i = 0; i < path_count && success; ++i) {
+        const char* path = paths[order[i]];
+
+        Part_Reader part = {};
+        part.success = 1;
+        if ((part.file = gzopen(path, "rb")) == NULL) {
+            fprintf(stderr, "error: failed to open part file (%s)\n", path);
+            success = 0;
+            break;
+        }
+
+        Part_Header header = {};
+        if (part_header_read(&part, &header)) {
+            part_load(book, &part, i);
+        }
+
+        if (!part.success) {
+            fprintf(stderr, "error: invalid part file (%s)\n", path);
+            success = 0;
+        }
+
+        gzclose(part.file);
+    }
+    trace_end(options->trace, "merge", NULL, 0);
+
+    free(order);
+
+    for (int i = 0; i < book->subbook_count && success; ++i) {
+        Book_Subbook* subbook = book->subbooks + i;
+        if (subbook->entry_end != subbook->entry_total) {
+            fprintf(stderr, "error: part files are missing entries of subbook %d\n", i);
+            success = 0;
+        }
+
+        subbook_media_link(subbook);
+
+        stats_select(options->stats, i);
+        stats_count(options->stats, STATS_COUNTER_ENTRIES, subbook->entry_count);
+    }
+
+    stats_select(options->stats, -1);
+
+    if (!success) {
+        return 0;
+    }
+
+    options->flags = first.flags | (options->flags & FLAG_PRETTY_PRINT);
+    options->sort = first.sort;
+
+    if (options->flags & FLAG_INTERN) {
+        for (int i = 0; i < book->subbook_count; ++i) {
+            Book_Subbook* subbook = book->subbooks + i;
+            for (int j = 0; j < subbook->entry_count; ++j) {
+                book_block_intern(&subbook->entries[j].heading, &subbook->strings);
+                book_block_intern(&subbook->entries[j].text, &subbook->strings);
+            }
+        }
+    }
+
+    book_finish(book, options);
     return 1;
 }
@@ -19,7 +19,12 @@
 #ifndef BOOK_H
 #define BOOK_H
 
-#include <stdio.h>
+#include <stddef.h>
+
+#include "match.h"
+#include "stats.h"
+#include "trace.h"
+#include "writer.h"
 
 /*
  * Types
@@ -27,13 +32,45 @@
 
 typedef struct Book Book;
 
+typedef enum {
+    BOOK_SORT_NONE,
+    BOOK_SORT_HEADING,
+} Book_Sort;
+
+typedef enum {
+    BOOK_SHARD_BOOK,
+    BOOK_SHARD_SUBBOOK,
+} Book_Shard;
+
+typedef struct Book_Options {
+    int         flags;
+    int         threads;
+    const char* gaiji_map_path;
+    const char* fetch_path;
+    const char* media_path;
+    Book_Sort   sort;
+    const char* shard_prefix;
+    int         shard_count;
+    Book_Shard  shard_by;
+    int         part_index;
+    int         part_count;
+    Match*      match_heading;
+    Match*      match_text;
+    int         font_sizes;
+    Stats*      stats;
+    Trace*      trace;
+} Book_Options;
+
 /*
  * Functions
  */
 
 Book* book_create();
 void book_destroy(Book* book);
-int book_import(Book* book, const char path[], int flags);
-int book_export(FILE* fp, const Book* book, int flags);
+int book_import(Book* book, const char path[], const Book_Options* options);
+int book_export(Writer* writer, const Book* book, const Book_Options* options);
+int book_export_shards(Writer* writer, const Book* book, const Book_Options* options, Writer_Compress compress);
+int book_export_part(Writer* writer, const Book* book, const Book_Options* options);
+int book_merge(Book* book, char* const paths[], int path_count, Book_Options* options);
 
 #endif /* BOOK_H */
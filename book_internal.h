@@ -0,0 +1,147 @@
+/*
+ * Copyright (C) 2017  Alex Yatskov <alex@foosoft.net>
+ * Author: Alex Yatskov <alex@foosoft.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef BOOK_INTERNAL_H
+#define BOOK_INTERNAL_H
+
+#include <stdint.h>
+
+#include "book.h"
+#include "hooks.h"
+#include "intern.h"
+
+#include "eb/eb/eb.h"
+#include "eb/eb/font.h"
+
+/*
+ * The book model shared by book.c and the benchmarks, which build books and
+ * run importer stages directly; nothing else should depend on it.
+ */
+
+/*
+ * Types
+ */
+
+typedef enum {
+    BOOK_MODE_TEXT,
+    BOOK_MODE_HEADING,
+} Book_Mode;
+
+typedef struct Book_Reference {
+    int page;
+    int offset;
+    int entry;
+} Book_Reference;
+
+typedef struct Book_Media_Ref {
+    Hook_Media  source;
+    int         media;
+    const char* file;
+} Book_Media_Ref;
+
+typedef struct Book_Block {
+    char*           text;
+    char*           key;
+    int             page;
+    int             offset;
+    Hook_Span*      spans;
+    int             span_count;
+    Book_Reference* references;
+    int             reference_count;
+    Book_Media_Ref* media;
+    int             media_count;
+    Hook_Glyph*     glyphs;
+    int             glyph_count;
+    int             string_id;
+    int             interned;
+} Book_Block;
+
+typedef struct Book_Entry{
+    Book_Block heading;
+    Book_Block text;
+    uint64_t   hash;
+    int        unmatched;
+} Book_Entry;
+
+typedef struct Book_Glyph {
+    char bitmap[EB_SIZE_WIDE_FONT_48];
+    int  code;
+} Book_Glyph;
+
+typedef struct Book_Glyph_Set {
+    Book_Glyph* glyphs;
+    int         bitmap_size;
+    int         width;
+    int         height;
+    int         count;
+} Book_Glyph_Set;
+
+typedef struct Book_Font {
+    Book_Glyph_Set wide;
+    Book_Glyph_Set narrow;
+} Book_Font;
+
+typedef struct Book_Media {
+    Hook_Media source;
+    char*      file;
+} Book_Media;
+
+typedef struct Book_Subbook {
+    char*       title;
+    Book_Block  copyright;
+
+    Book_Entry* entries;
+    int         entry_count;
+    int         entry_alloc;
+    int         entry_start;
+    int         entry_end;
+    int         entry_total;
+
+    Intern_Pool strings;
+
+    Book_Media* media;
+    int         media_count;
+
+    uint64_t hash;
+
+    Book_Font fonts[4];
+} Book_Subbook;
+
+typedef struct Book_Fetch {
+    int        subbook;
+    Book_Mode  mode;
+    Book_Block block;
+} Book_Fetch;
+
+typedef struct Book {
+    char          char_code[32];
+    char          disc_code[32];
+    Book_Subbook* subbooks;
+    int           subbook_count;
+    Book_Fetch*   fetches;
+    int           fetch_count;
+    int           fetch_alloc;
+} Book;
+
+/*
+ * Functions
+ */
+
+void subbook_undupe(Book_Subbook* subbook);
+
+#endif /* BOOK_INTERNAL_H */
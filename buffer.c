@@ -0,0 +1,68 @@
+/*
+ * Copyright (C) 2017  Alex Yatskov <alex@foosoft.net>
+ * Author: Alex Yatskov <alex@foosoft.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "buffer.h"
+
+/*
+ * Exported functions
+ */
+
+void buffer_init(Buffer* buffer) {
+    memset(buffer, 0, sizeof(Buffer));
+}
+
+void buffer_free(Buffer* buffer) {
+    free(buffer->data);
+    buffer_init(buffer);
+}
+
+void buffer_clear(Buffer* buffer) {
+    buffer->size = 0;
+}
+
+void buffer_reserve(Buffer* buffer, size_t size) {
+    if (buffer->size + size <= buffer->alloc) {
+        return;
+    }
+
+    size_t alloc = buffer->alloc == 0 ? 256 : buffer->alloc;
+    while (alloc < buffer->size + size) {
+        alloc *= 2;
+    }
+
+    buffer->data = realloc(buffer->data, alloc);
+    buffer->alloc = alloc;
+}
+
+void buffer_append(Buffer* buffer, const char data[], size_t size) {
+    buffer_reserve(buffer, size);
+    memcpy(buffer->data + buffer->size, data, size);
+    buffer->size += size;
+}
+
+void buffer_append_string(Buffer* buffer, const char str[]) {
+    buffer_append(buffer, str, strlen(str));
+}
+
+void buffer_append_char(Buffer* buffer, char c) {
+    buffer_reserve(buffer, 1);
+    buffer->data[buffer->size++] = c;
+}
@@ -0,0 +1,47 @@
+/*
+ * Copyright (C) 2017  Alex Yatskov <alex@foosoft.net>
+ * Author: Alex Yatskov <alex@foosoft.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef BUFFER_H
+#define BUFFER_H
+
+#include <stddef.h>
+
+/*
+ * Types
+ */
+
+typedef struct Buffer {
+    char*  data;
+    size_t size;
+    size_t alloc;
+} Buffer;
+
+/*
+ * Functions
+ */
+
+void buffer_init(Buffer* buffer);
+void buffer_free(Buffer* buffer);
+void buffer_clear(Buffer* buffer);
+void buffer_reserve(Buffer* buffer, size_t size);
+void buffer_append(Buffer* buffer, const char data[], size_t size);
+void buffer_append_string(Buffer* buffer, const char str[]);
+void buffer_append_char(Buffer* buffer, char c);
+
+#endif /* BUFFER_H */
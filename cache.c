@@ -0,0 +1,363 @@
+/*
+ * Copyright (C) 2017  Alex Yatskov <alex@foosoft.net>
+ * Author: Alex Yatskov <alex@foosoft.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include "cache.h"
+
+#include "eb/eb/eb.h"
+#include "eb/eb/zio.h"
+
+/*
+ * Local types
+ */
+
+typedef struct Cache_Slice {
+    struct Cache_Slice* next;
+    struct Cache_Slice* newer;
+    struct Cache_Slice* older;
+    unsigned long long  device;
+    unsigned long long  inode;
+    off_t               file_size;
+    off_t               index;
+    size_t              size;
+    char                data[];
+} Cache_Slice;
+
+typedef struct Cache_File {
+    int                zio;
+    unsigned long long device;
+    unsigned long long inode;
+} Cache_File;
+
+typedef struct Cache {
+    pthread_mutex_t mutex;
+    Cache_Slice**   buckets;
+    int             bucket_count;
+    Cache_File*     files;
+    int             file_count;
+    int             file_slots;
+    Cache_Slice*    newest;
+    Cache_Slice*    oldest;
+    size_t          capacity;
+    size_t          used;
+    Cache_Counts    counts;
+} Cache;
+
+/*
+ * Local data
+ */
+
+static Cache s_cache = { .mutex = PTHREAD_MUTEX_INITIALIZER };
+
+#ifdef ZIO_CACHE
+
+/*
+ * Local functions
+ */
+
+ssize_t __real_zio_read(Zio* zio, char* buffer, size_t length);
+
+static Cache_Slice** cache_bucket(const Cache_File* file, off_t index) {
+    const unsigned long long key = (file->inode * 0x100000001b3ULL ^ file->device) << 20 ^ (unsigned long long)index;
+    return s_cache.buckets + ((key * 0x9e3779b97f4a7c15ULL >> 32) & (s_cache.bucket_count - 1));
+}
+
+static Cache_File* cache_file_slot(int zio) {
+    int slot = ((unsigned)zio * 0x9e3779b9U) & (s_cache.file_slots - 1);
+    while (s_cache.files[slot].zio >= 0 && s_cache.files[slot].zio != zio) {
+        slot = (slot + 1) & (s_cache.file_slots - 1);
+    }
+
+    return s_cache.files + slot;
+}
+
+/*
+ * Each eb_bind opens files under new zio ids, so slices are keyed by the
+ * file itself and are shared between the main reader and workers that bind
+ * books of their own. The identity of an id is looked up once and kept; on
+ * Windows, where files have no inode number, the id stands in for it.
+ */
+
+static Cache_File cache_file(const Zio* zio) {
+    if ((s_cache.file_count + 1) * 2 > s_cache.file_slots) {
+        Cache_File* files = s_cache.files;
+        const int file_slots = s_cache.file_slots;
+
+        s_cache.file_slots = file_slots == 0 ? 64 : file_slots * 2;
+        s_cache.files = malloc(s_cache.file_slots * sizeof(Cache_File));
+        memset(s_cache.files, 0xff, s_cache.file_slots * sizeof(Cache_File));
+        for (int i = 0; i < file_slots; ++i) {
+            if (files[i].zio >= 0) {
+                *cache_file_slot(files[i].zio) = files[i];
+            }
+        }
+
+        free(files);
+    }
+
+    Cache_File* file = cache_file_slot(zio->id);
+    if (file->zio < 0) {
+        struct stat info;
+        file->zio = zio->id;
+        file->device = 0;
+        file->inode = 0;
+#ifndef _WIN32
+        if (fstat(zio->file, &info) == 0) {
+            file->device = info.st_dev;
+            file->inode = info.st_ino;
+        }
+#else
+        (void)info;
+#endif
+        if (file->inode == 0) {
+            file->device = ~0ULL;
+            file->inode = zio->id;
+        }
+
+        ++s_cache.file_count;
+    }
+
+    return *file;
+}
+
+static void cache_unlink(Cache_Slice* slice) {
+    if (slice->newer != NULL) {
+        slice->newer->older = slice->older;
+    }
+    else {
+        s_cache.newest = slice->older;
+    }
+
+    if (slice->older != NULL) {
+        slice->older->newer = slice->newer;
+    }
+    else {
+        s_cache.oldest = slice->newer;
+    }
+}
+
+static void cache_push(Cache_Slice* slice) {
+    slice->newer = NULL;
+    slice->older = s_cache.newest;
+    if (s_cache.newest != NULL) {
+        s_cache.newest->newer = slice;
+    }
+    else {
+        s_cache.oldest = slice;
+    }
+
+    s_cache.newest = slice;
+}
+
+static void cache_evict() {
+    Cache_Slice* slice = s_cache.oldest;
+    cache_unlink(slice);
+
+    const Cache_File file = {-1, slice->device, slice->inode};
+    Cache_Slice** link = cache_bucket(&file, slice->index);
+    while (*link != slice) {
+        link = &(*link)->next;
+    }
+
+    *link = slice->next;
+    s_cache.used -= slice->size;
+    free(slice);
+}
+
+/* Copies from a cached slice while the lock is held, so the slice cannot be evicted meanwhile. */
+static size_t cache_copy(const Zio* zio, off_t index, size_t skip, char buffer[], size_t length, Cache_File* file) {
+    pthread_mutex_lock(&s_cache.mutex);
+
+    *file = cache_file(zio);
+    Cache_Slice* slice = *cache_bucket(file, index);
+    while (
+        slice != NULL && (
+            slice->device != file->device ||
+            slice->inode != file->inode ||
+            slice->file_size != zio->file_size ||
+            slice->index != index
+        )
+    ) {
+        slice = slice->next;
+    }
+
+    size_t copied = 0;
+    if (slice != NULL) {
+        copied = slice->size > skip ? slice->size - skip : 0;
+        copied = copied < length ? copied : length;
+        memcpy(buffer, slice->data + skip, copied);
+
+        cache_unlink(slice);
+        cache_push(slice);
+        ++s_cache.counts.hits;
+    }
+
+    pthread_mutex_unlock(&s_cache.mutex);
+    return slice != NULL ? copied : (size_t)-1;
+}
+
+static void cache_insert(Cache_Slice* slice) {
+    pthread_mutex_lock(&s_cache.mutex);
+
+    ++s_cache.counts.misses;
+    if (slice->size <= s_cache.capacity) {
+        while (s_cache.used + slice->size > s_cache.capacity) {
+            cache_evict();
+        }
+
+        const Cache_File file = {-1, slice->device, slice->inode};
+        Cache_Slice** bucket = cache_bucket(&file, slice->index);
+        slice->next = *bucket;
+        *bucket = slice;
+        cache_push(slice);
+        s_cache.used += slice->size;
+        slice = NULL;
+    }
+
+    pthread_mutex_unlock(&s_cache.mutex);
+    free(slice);
+}
+
+/*
+ * Reads of compressed files are served a whole decompressed slice at a time,
+ * keyed by the file and the slice index; the file size is compared as well
+ * in case a file is replaced while a book is read.
+ */
+
+ssize_t __wrap_zio_read(Zio* zio, char* buffer, size_t length) {
+    const int compressed = zio->code == ZIO_EBZIP1 || zio->code == ZIO_EPWING || zio->code == ZIO_EPWING6;
+    if (s_cache.capacity == 0 || !compressed || zio->slice_size == 0) {
+        return __real_zio_read(zio, buffer, length);
+    }
+
+    const off_t start = zio->location;
+    size_t done = 0;
+
+    while (done < length && start + (off_t)done < zio->file_size) {
+        const off_t location = start + done;
+        const off_t index = location / zio->slice_size;
+        const size_t skip = location % zio->slice_size;
+
+        Cache_File file;
+        size_t copied = cache_copy(zio, index, skip, buffer + done, length - done, &file);
+        if (copied == (size_t)-1) {
+            const off_t slice_start = index * zio->slice_size;
+            const off_t remaining = zio->file_size - slice_start;
+            const size_t size = remaining < (off_t)zio->slice_size ? (size_t)remaining : zio->slice_size;
+
+            Cache_Slice* slice = malloc(sizeof(Cache_Slice) + size);
+            ssize_t size_read = -1;
+            if (zio_lseek(zio, slice_start, SEEK_SET) == slice_start) {
+                size_read = __real_zio_read(zio, slice->data, size);
+            }
+
+            if (size_read <= 0) {
+                free(slice);
+                zio_lseek(zio, location, SEEK_SET);
+                return done > 0 ? (ssize_t)done : size_read;
+            }
+
+            slice->device = file.device;
+            slice->inode = file.inode;
+            slice->file_size = zio->file_size;
+            slice->index = index;
+            slice->size = size_read;
+
+            copied = size_read > (ssize_t)skip ? size_read - skip : 0;
+            copied = copied < length - done ? copied : length - done;
+            memcpy(buffer + done, slice->data + skip, copied);
+            cache_insert(slice);
+        }
+
+        if (copied == 0) {
+            break;
+        }
+
+        done += copied;
+    }
+
+    zio_lseek(zio, start + done, SEEK_SET);
+    return done;
+}
+
+#endif /* ZIO_CACHE */
+
+/*
+ * Exported functions
+ */
+
+/*
+ * Sets aside up to the given number of bytes for decompressed slices of
+ * ebzip and EPWING compressed files. Caching relies on the linker wrapping
+ * zio_read, so this fails on platforms built without it.
+ */
+
+int cache_init(size_t capacity) {
+#ifdef ZIO_CACHE
+    cache_free();
+
+    int bucket_count = 64;
+    while (bucket_count < (int)(capacity / 2048) && bucket_count < (1 << 24)) {
+        bucket_count *= 2;
+    }
+
+    s_cache.buckets = calloc(bucket_count, sizeof(Cache_Slice*));
+    s_cache.bucket_count = bucket_count;
+    s_cache.capacity = capacity;
+    return 1;
+#else
+    (void)capacity;
+    return 0;
+#endif
+}
+
+void cache_free() {
+    pthread_mutex_lock(&s_cache.mutex);
+
+    while (s_cache.oldest != NULL) {
+        Cache_Slice* slice = s_cache.oldest;
+        s_cache.oldest = slice->newer;
+        free(slice);
+    }
+
+    free(s_cache.buckets);
+    s_cache.buckets = NULL;
+    s_cache.bucket_count = 0;
+    free(s_cache.files);
+    s_cache.files = NULL;
+    s_cache.file_count = 0;
+    s_cache.file_slots = 0;
+    s_cache.newest = NULL;
+    s_cache.capacity = 0;
+    s_cache.used = 0;
+
+    pthread_mutex_unlock(&s_cache.mutex);
+}
+
+Cache_Counts cache_counts() {
+    pthread_mutex_lock(&s_cache.mutex);
+    const Cache_Counts counts = s_cache.counts;
+    pthread_mutex_unlock(&s_cache.mutex);
+    return counts;
+}
@@ -0,0 +1,170 @@
+/*
+ * Copyright (C) 2017  Alex Yatskov <alex@foosoft.net>
+ * Author: Alex Yatskov <alex@foosoft.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "collate.h"
+#include "util.h"
+
+/*
+ * Local data
+ */
+
+/* Base kana for U+3041 through U+3096 relative to U+3040, with voicing marks removed and small kana made full size. */
+static const unsigned char s_kana_base[] = {
+    0x02, 0x02, 0x04, 0x04, 0x06, 0x06, 0x08, 0x08,
+    0x0a, 0x0a, 0x0b, 0x0b, 0x0d, 0x0d, 0x0f, 0x0f,
+    0x11, 0x11, 0x13, 0x13, 0x15, 0x15, 0x17, 0x17,
+    0x19, 0x19, 0x1b, 0x1b, 0x1d, 0x1d, 0x1f, 0x1f,
+    0x21, 0x21, 0x24, 0x24, 0x24, 0x26, 0x26, 0x28,
+    0x28, 0x2a, 0x2b, 0x2c, 0x2d, 0x2e, 0x2f, 0x2f,
+    0x2f, 0x32, 0x32, 0x32, 0x35, 0x35, 0x35, 0x38,
+    0x38, 0x38, 0x3b, 0x3b, 0x3b, 0x3e, 0x3f, 0x40,
+    0x41, 0x42, 0x44, 0x44, 0x46, 0x46, 0x48, 0x48,
+    0x49, 0x4a, 0x4b, 0x4c, 0x4d, 0x4f, 0x4f, 0x50,
+    0x51, 0x52, 0x53, 0x06, 0x0b, 0x11,
+};
+
+/*
+ * Local functions
+ */
+
+static unsigned int collate_decode(const unsigned char** text) {
+    const unsigned char* ptr = *text;
+    unsigned int code_point = *ptr++;
+    int length = 0;
+
+    if (code_point >= 0xf0) {
+        code_point &= 0x07;
+        length = 3;
+    }
+    else if (code_point >= 0xe0) {
+        code_point &= 0x0f;
+        length = 2;
+    }
+    else if (code_point >= 0xc0) {
+        code_point &= 0x1f;
+        length = 1;
+    }
+
+    for (; length > 0 && (*ptr & 0xc0) == 0x80; --length) {
+        code_point = code_point << 6 | (*ptr++ & 0x3f);
+    }
+
+    *text = ptr;
+    return code_point;
+}
+
+static void collate_encode(Buffer* key, unsigned int code_point) {
+    if (code_point < 0x80) {
+        buffer_append_char(key, code_point);
+    }
+    else if (code_point < 0x800) {
+        buffer_append_char(key, 0xc0 | (code_point >> 6));
+        buffer_append_char(key, 0x80 | (code_point & 0x3f));
+    }
+    else if (code_point < 0x10000) {
+        buffer_append_char(key, 0xe0 | (code_point >> 12));
+        buffer_append_char(key, 0x80 | ((code_point >> 6) & 0x3f));
+        buffer_append_char(key, 0x80 | (code_point & 0x3f));
+    }
+    else {
+        buffer_append_char(key, 0xf0 | (code_point >> 18));
+        buffer_append_char(key, 0x80 | ((code_point >> 12) & 0x3f));
+        buffer_append_char(key, 0x80 | ((code_point >> 6) & 0x3f));
+        buffer_append_char(key, 0x80 | (code_point & 0x3f));
+    }
+}
+
+static int collate_ignorable(unsigned int code_point) {
+    switch (code_point) {
+        case ' ':
+        case '\t':
+        case '\n':
+        case '-':
+        case 0x2010: /* hyphen */
+        case 0x2011: /* non-breaking hyphen */
+        case 0x3000: /* ideographic space */
+        case 0x30fb: /* katakana middle dot */
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+/* Folds width, letter case and katakana to hiragana. */
+static unsigned int collate_fold(unsigned int code_point) {
+    if (code_point >= 0xff01 && code_point <= 0xff5e) {
+        code_point -= 0xfee0;
+    }
+
+    if (code_point >= 'A' && code_point <= 'Z') {
+        code_point += 'a' - 'A';
+    }
+
+    if (code_point >= 0x30a1 && code_point <= 0x30f6) {
+        code_point -= 0x60;
+    }
+
+    return code_point;
+}
+
+/*
+ * Exported functions
+ */
+
+/*
+ * Builds a key whose byte order is the dictionary order of the text: first
+ * by base kana, ignoring voicing marks and small kana, then by the folded
+ * text, and finally by the text itself so that distinct headings never tie.
+ * Inline markup tags are skipped when markup is enabled.
+ */
+
+void collate_key(Buffer* key, const char text[], int flags) {
+    for (int level = 0; level < 2; ++level) {
+        const unsigned char* ptr = (const unsigned char*)text;
+        while (*ptr != 0) {
+            if (*ptr == '<' && (flags & FLAG_HOOK_MARKUP)) {
+                while (*ptr != 0 && *ptr != '>') {
+                    ++ptr;
+                }
+
+                if (*ptr == '>') {
+                    ++ptr;
+                }
+
+                continue;
+            }
+
+            unsigned int code_point = collate_decode(&ptr);
+            if (collate_ignorable(code_point)) {
+                continue;
+            }
+
+            code_point = collate_fold(code_point);
+            if (level == 0 && code_point >= 0x3041 && code_point <= 0x3096) {
+                code_point = 0x3040 + s_kana_base[code_point - 0x3041];
+            }
+
+            collate_encode(key, code_point);
+        }
+
+        buffer_append_char(key, 0);
+    }
+
+    buffer_append_string(key, text);
+}
@@ -17,10 +17,80 @@
  */
 
 #include <iconv.h>
+#include <pthread.h>
+#include <stdint.h>
 #include <string.h>
 #include <errno.h>
 #include <stdlib.h>
 
+#include "convert.h"
+#include "buffer.h"
+
+/*
+ * Macros
+ */
+
+#define CONVERT_JIS_CELLS 94
+#define CONVERT_KANA_COUNT 63
+
+/*
+ * Local types
+ */
+
+typedef struct Convert_Char {
+    char          text[3];
+    unsigned char text_size;
+    char          normalized[11];
+    unsigned char normalized_size;
+} Convert_Char;
+
+typedef struct Convert_Rule {
+    unsigned int code_point;
+    const char*  text;
+} Convert_Rule;
+
+/*
+ * Local data
+ */
+
+/* NFKC forms of the characters in JIS X 0208 which are not covered by the fullwidth ASCII range. */
+static const Convert_Rule s_normalize_rules[] = {
+    { 0x00a8, " \xcc\x88"                 },
+    { 0x00b4, " \xcc\x81"                 },
+    { 0x2025, ".."                        },
+    { 0x2026, "..."                       },
+    { 0x2033, "\xe2\x80\xb2\xe2\x80\xb2"  },
+    { 0x2103, "\xc2\xb0" "C"               },
+    { 0x212b, "\xc3\x85"                  },
+    { 0x222c, "\xe2\x88\xab\xe2\x88\xab"  },
+    { 0x3000, " "                         },
+    { 0x309b, " \xe3\x82\x99"             },
+    { 0x309c, " \xe3\x82\x9a"             },
+    { 0xffe0, "\xc2\xa2"                  },
+    { 0xffe1, "\xc2\xa3"                  },
+    { 0xffe2, "\xc2\xac"                  },
+    { 0xffe3, " \xcc\x84"                 },
+    { 0xffe4, "\xc2\xa6"                  },
+    { 0xffe5, "\xc2\xa5"                  },
+};
+
+/* Fullwidth forms of the halfwidth katakana U+FF61 through U+FF9F. */
+static const uint16_t s_halfwidth_kana[CONVERT_KANA_COUNT] = {
+    0x3002, 0x300c, 0x300d, 0x3001, 0x30fb, 0x30f2, 0x30a1, 0x30a3,
+    0x30a5, 0x30a7, 0x30a9, 0x30e3, 0x30e5, 0x30e7, 0x30c3, 0x30fc,
+    0x30a2, 0x30a4, 0x30a6, 0x30a8, 0x30aa, 0x30ab, 0x30ad, 0x30af,
+    0x30b1, 0x30b3, 0x30b5, 0x30b7, 0x30b9, 0x30bb, 0x30bd, 0x30bf,
+    0x30c1, 0x30c4, 0x30c6, 0x30c8, 0x30ca, 0x30cb, 0x30cc, 0x30cd,
+    0x30ce, 0x30cf, 0x30d2, 0x30d5, 0x30d8, 0x30db, 0x30de, 0x30df,
+    0x30e0, 0x30e1, 0x30e2, 0x30e4, 0x30e6, 0x30e8, 0x30e9, 0x30ea,
+    0x30eb, 0x30ec, 0x30ed, 0x30ef, 0x30f3, 0x3099, 0x309a,
+};
+
+/* Two byte JIS X 0208 characters and the one byte halfwidth katakana that follow 0x8e. */
+static Convert_Char s_jis_chars[CONVERT_JIS_CELLS * CONVERT_JIS_CELLS];
+static Convert_Char s_kana_chars[CONVERT_KANA_COUNT];
+static pthread_once_t s_tables_once = PTHREAD_ONCE_INIT;
+
 /*
  * Local functions
  */
@@ -112,10 +182,300 @@ static char * convert (const char *from_charset, const char *to_charset, const c
     return output;
 }
 
+static unsigned int convert_decode(const unsigned char** text) {
+    const unsigned char* ptr = *text;
+    unsigned int code_point = *ptr++;
+    int length = 0;
+
+    if (code_point >= 0xf0) {
+        code_point &= 0x07;
+        length = 3;
+    }
+    else if (code_point >= 0xe0) {
+        code_point &= 0x0f;
+        length = 2;
+    }
+    else if (code_point >= 0xc0) {
+        code_point &= 0x1f;
+        length = 1;
+    }
+
+    for (; length > 0 && (*ptr & 0xc0) == 0x80; --length) {
+        code_point = code_point << 6 | (*ptr++ & 0x3f);
+    }
+
+    *text = ptr;
+    return code_point;
+}
+
+static void convert_encode(Buffer* buffer, unsigned int code_point) {
+    if (code_point < 0x80) {
+        buffer_append_char(buffer, code_point);
+    }
+    else if (code_point < 0x800) {
+        buffer_append_char(buffer, 0xc0 | (code_point >> 6));
+        buffer_append_char(buffer, 0x80 | (code_point & 0x3f));
+    }
+    else if (code_point < 0x10000) {
+        buffer_append_char(buffer, 0xe0 | (code_point >> 12));
+        buffer_append_char(buffer, 0x80 | ((code_point >> 6) & 0x3f));
+        buffer_append_char(buffer, 0x80 | (code_point & 0x3f));
+    }
+    else {
+        buffer_append_char(buffer, 0xf0 | (code_point >> 18));
+        buffer_append_char(buffer, 0x80 | ((code_point >> 12) & 0x3f));
+        buffer_append_char(buffer, 0x80 | ((code_point >> 6) & 0x3f));
+        buffer_append_char(buffer, 0x80 | (code_point & 0x3f));
+    }
+}
+
+/* Combines a fullwidth katakana with a following voiced or semi-voiced sound mark; returns zero if they do not compose. */
+static unsigned int convert_compose(unsigned int base, unsigned int mark) {
+    const int ha_row = base >= 0x30cf && base <= 0x30db && (base - 0x30cf) % 3 == 0;
+
+    if (mark == 0x3099) {
+        if ((base >= 0x30ab && base <= 0x30c1 && (base - 0x30ab) % 2 == 0) || base == 0x30c4 || base == 0x30c6 || base == 0x30c8 || ha_row) {
+            return base + 1;
+        }
+
+        switch (base) {
+            case 0x30a6:
+                return 0x30f4;
+            case 0x30ef:
+                return 0x30f7;
+            case 0x30f2:
+                return 0x30fa;
+        }
+    }
+    else if (mark == 0x309a && ha_row) {
+        return base + 2;
+    }
+
+    return 0;
+}
+
+static void convert_normalize(Buffer* buffer, unsigned int code_point) {
+    if (code_point >= 0xff01 && code_point <= 0xff5e) {
+        buffer_append_char(buffer, code_point - 0xfee0);
+        return;
+    }
+
+    if (code_point >= 0xff61 && code_point <= 0xff9f) {
+        convert_encode(buffer, s_halfwidth_kana[code_point - 0xff61]);
+        return;
+    }
+
+    for (unsigned i = 0; i < sizeof(s_normalize_rules) / sizeof(s_normalize_rules[0]); ++i) {
+        if (s_normalize_rules[i].code_point == code_point) {
+            buffer_append_string(buffer, s_normalize_rules[i].text);
+            return;
+        }
+    }
+
+    convert_encode(buffer, code_point);
+}
+
+static void convert_char_init(Convert_Char* c, unsigned int code_point) {
+    Buffer buffer = {};
+
+    convert_encode(&buffer, code_point);
+    memcpy(c->text, buffer.data, buffer.size);
+    c->text_size = buffer.size;
+
+    buffer_clear(&buffer);
+    convert_normalize(&buffer, code_point);
+    memcpy(c->normalized, buffer.data, buffer.size);
+    c->normalized_size = buffer.size;
+
+    buffer_free(&buffer);
+}
+
+/*
+ * Builds the decoding tables by asking iconv for every JIS X 0208 character
+ * once, so the table decoder produces exactly what iconv would; characters it
+ * cannot map are left empty and send the whole string down the iconv path.
+ */
+
+static void convert_tables_init(void) {
+    for (int i = 0; i < CONVERT_KANA_COUNT; ++i) {
+        convert_char_init(s_kana_chars + i, 0xff61 + i);
+    }
+
+    iconv_t cd = iconv_open("UTF-8", "EUC-JP");
+    if (cd == (iconv_t)-1) {
+        return;
+    }
+
+    for (int i = 0; i < CONVERT_JIS_CELLS * CONVERT_JIS_CELLS; ++i) {
+        char input[] = {0xa1 + i / CONVERT_JIS_CELLS, 0xa1 + i % CONVERT_JIS_CELLS};
+        char output[8];
+
+        char* inbuf = input;
+        char* outbuf = output;
+        size_t inleft = sizeof(input);
+        size_t outleft = sizeof(output);
+
+        if (iconv(cd, &inbuf, &inleft, &outbuf, &outleft) != (size_t)-1 && inleft == 0) {
+            *outbuf = 0;
+            const unsigned char* text = (const unsigned char*)output;
+            const unsigned int code_point = convert_decode(&text);
+            if (*text == 0 && code_point < 0x10000) {
+                convert_char_init(s_jis_chars + i, code_point);
+            }
+        }
+
+        iconv(cd, NULL, NULL, NULL, NULL);
+    }
+
+    iconv_close(cd);
+}
+
+/*
+ * Decodes with the tables, writing to whichever of the outputs are given.
+ * Returns zero on input the tables do not cover (JIS X 0212, unmapped or
+ * invalid sequences), which is left to iconv. A sequence cut short at the
+ * end of the input is dropped, as iconv does.
+ */
+
+static int convert_tables_decode(const char src[], Buffer* text, Buffer* normalized) {
+    const unsigned char* input = (const unsigned char*)src;
+    int mark_composed = 0;
+
+    while (*input != 0) {
+        const unsigned char lead = input[0];
+        if (lead < 0x80) {
+            if (text != NULL) {
+                buffer_append_char(text, lead);
+            }
+
+            if (normalized != NULL) {
+                buffer_append_char(normalized, lead);
+            }
+
+            ++input;
+            continue;
+        }
+
+        if (input[1] == 0 && (lead == 0x8e || (lead >= 0xa1 && lead <= 0xfe))) {
+            break;
+        }
+
+        const Convert_Char* c = NULL;
+        if (lead == 0x8e && input[1] >= 0xa1 && input[1] <= 0xdf) {
+            c = s_kana_chars + input[1] - 0xa1;
+        }
+        else if (lead >= 0xa1 && lead <= 0xfe && input[1] >= 0xa1 && input[1] <= 0xfe) {
+            c = s_jis_chars + (lead - 0xa1) * CONVERT_JIS_CELLS + input[1] - 0xa1;
+        }
+
+        if (c == NULL || c->text_size == 0) {
+            return 0;
+        }
+
+        if (text != NULL) {
+            buffer_append(text, c->text, c->text_size);
+        }
+
+        if (normalized != NULL) {
+            if (mark_composed) {
+                mark_composed = 0;
+            }
+            else if (lead == 0x8e && input[2] == 0x8e && (input[3] == 0xde || input[3] == 0xdf)) {
+                const unsigned int base = s_halfwidth_kana[input[1] - 0xa1];
+                const unsigned int composed = convert_compose(base, input[3] == 0xde ? 0x3099 : 0x309a);
+                if (composed != 0) {
+                    convert_encode(normalized, composed);
+                    mark_composed = 1;
+                }
+                else {
+                    buffer_append(normalized, c->normalized, c->normalized_size);
+                }
+            }
+            else {
+                buffer_append(normalized, c->normalized, c->normalized_size);
+            }
+        }
+
+        input += 2;
+    }
+
+    return 1;
+}
+
+static char* convert_normalize_text(const char src[]) {
+    Buffer normalized = {};
+
+    const unsigned char* input = (const unsigned char*)src;
+    while (*input != 0) {
+        const unsigned int code_point = convert_decode(&input);
+        if (code_point >= 0xff61 && code_point <= 0xff9d) {
+            const unsigned char* next = input;
+            const unsigned int mark = *next != 0 ? convert_decode(&next) : 0;
+            if (mark == 0xff9e || mark == 0xff9f) {
+                const unsigned int composed = convert_compose(s_halfwidth_kana[code_point - 0xff61], mark == 0xff9e ? 0x3099 : 0x309a);
+                if (composed != 0) {
+                    convert_encode(&normalized, composed);
+                    input = next;
+                    continue;
+                }
+            }
+        }
+
+        convert_normalize(&normalized, code_point);
+    }
+
+    buffer_append_char(&normalized, 0);
+    return normalized.data;
+}
+
 /*
  * Exported functions
  */
 
+char* utf8_normalize(const char src[]) {
+    return convert_normalize_text(src);
+}
+
 char* eucjp_to_utf8(const char src[]) {
-    return convert("EUC-JP", "UTF-8", src);
+    char* text = NULL;
+    eucjp_to_utf8_normalized(src, &text, NULL);
+    return text;
+}
+
+int eucjp_to_utf8_normalized(const char src[], char** text, char** normalized) {
+    pthread_once(&s_tables_once, convert_tables_init);
+
+    Buffer text_buffer = {};
+    Buffer normalized_buffer = {};
+
+    if (convert_tables_decode(src, text != NULL ? &text_buffer : NULL, normalized != NULL ? &normalized_buffer : NULL)) {
+        if (text != NULL) {
+            buffer_append_char(&text_buffer, 0);
+            *text = text_buffer.data;
+        }
+
+        if (normalized != NULL) {
+            buffer_append_char(&normalized_buffer, 0);
+            *normalized = normalized_buffer.data;
+        }
+
+        return 1;
+    }
+
+    buffer_free(&text_buffer);
+    buffer_free(&normalized_buffer);
+
+    char* converted = convert("EUC-JP", "UTF-8", src);
+    if (normalized != NULL) {
+        *normalized = converted != NULL ? convert_normalize_text(converted) : NULL;
+    }
+
+    if (text != NULL) {
+        *text = converted;
+    }
+    else {
+        free(converted);
+    }
+
+    return converted != NULL;
 }
@@ -24,5 +24,7 @@
  */
 
 char* eucjp_to_utf8(const char src[]);
+int eucjp_to_utf8_normalized(const char src[], char** text, char** normalized);
+char* utf8_normalize(const char src[]);
 
 #endif /* CONVERT_H */
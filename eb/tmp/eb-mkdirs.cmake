@@ -0,0 +1,22 @@
+# Distributed under the OSI-approved BSD 3-Clause License.  See accompanying
+# file Copyright.txt or https://cmake.org/licensing for details.
+
+cmake_minimum_required(VERSION 3.5)
+
+file(MAKE_DIRECTORY
+  "/root/repo/eb"
+  "/root/repo/eb/src/eb-build"
+  "/root/repo/eb"
+  "/root/repo/eb/tmp"
+  "/root/repo/eb/src/eb-stamp"
+  "/root/repo/eb/src"
+  "/root/repo/eb/src/eb-stamp"
+)
+
+set(configSubDirs )
+foreach(subDir IN LISTS configSubDirs)
+    file(MAKE_DIRECTORY "/root/repo/eb/src/eb-stamp/${subDir}")
+endforeach()
+if(cfgdir)
+  file(MAKE_DIRECTORY "/root/repo/eb/src/eb-stamp${cfgdir}") # cfgdir has leading slash
+endif()
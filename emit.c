@@ -0,0 +1,331 @@
+/*
+ * Copyright (C) 2017  Alex Yatskov <alex@foosoft.net>
+ * Author: Alex Yatskov <alex@foosoft.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <stdint.h>
+#include <string.h>
+
+#include "emit.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && defined(__SSE2__)
+#define EMIT_SSE 1
+#include <immintrin.h>
+#endif
+
+/*
+ * Local data
+ */
+
+static const char s_hex_digits[] = "0123456789ABCDEF";
+
+/* Set by emit_force_scalar so tests can reach the portable paths on any processor. */
+static int s_scalar;
+
+/*
+ * Local functions
+ */
+
+/* Same rules as jansson's utf8_check: no overlong forms, surrogates or code points past U+10FFFF. */
+static int emit_utf8_check_scalar(const unsigned char text[], size_t size) {
+    size_t i = 0;
+    while (i < size) {
+        const unsigned char c = text[i];
+        if (c < 0x80) {
+            ++i;
+            continue;
+        }
+
+        size_t length;
+        uint32_t code_point;
+        if (c >= 0xc2 && c <= 0xdf) {
+            length = 2;
+            code_point = c & 0x1f;
+        }
+        else if (c >= 0xe0 && c <= 0xef) {
+            length = 3;
+            code_point = c & 0x0f;
+        }
+        else if (c >= 0xf0 && c <= 0xf4) {
+            length = 4;
+            code_point = c & 0x07;
+        }
+        else {
+            return 0;
+        }
+
+        if (size - i < length) {
+            return 0;
+        }
+
+        for (size_t j = 1; j < length; ++j) {
+            const unsigned char continuation = text[i + j];
+            if ((continuation & 0xc0) != 0x80) {
+                return 0;
+            }
+
+            code_point = code_point << 6 | (continuation & 0x3f);
+        }
+
+        if ((length == 3 && code_point < 0x800) || (length == 4 && code_point < 0x10000)) {
+            return 0;
+        }
+
+        if (code_point > 0x10ffff || (code_point >= 0xd800 && code_point <= 0xdfff)) {
+            return 0;
+        }
+
+        i += length;
+    }
+
+    return 1;
+}
+
+#ifdef EMIT_SSE
+
+/*
+ * Table driven validation after Keiser and Lemire, "Validating UTF-8 In Less
+ * Than One Instruction Per Byte". The high and low nibbles of each byte and
+ * the high nibble of the byte after it index three tables whose intersection
+ * flags every invalid two byte sequence; three and four byte sequences are
+ * then checked for the right number of continuation bytes.
+ */
+
+#define UTF8_TOO_SHORT      (1 << 0)
+#define UTF8_TOO_LONG       (1 << 1)
+#define UTF8_OVERLONG_3     (1 << 2)
+#define UTF8_TOO_LARGE      (1 << 3)
+#define UTF8_SURROGATE      (1 << 4)
+#define UTF8_OVERLONG_2     (1 << 5)
+#define UTF8_TOO_LARGE_1000 (1 << 6)
+#define UTF8_OVERLONG_4     (1 << 6)
+#define UTF8_TWO_CONTS      (1 << 7)
+#define UTF8_CARRY          (UTF8_TOO_SHORT | UTF8_TOO_LONG | UTF8_TWO_CONTS)
+
+typedef struct Utf8_State {
+    __m128i error;
+    __m128i previous;
+    __m128i incomplete;
+} Utf8_State;
+
+__attribute__((target("ssse3")))
+static __m128i emit_utf8_special_cases(__m128i input, __m128i previous1) {
+    const __m128i byte_1_high_table = _mm_setr_epi8(
+        UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG,
+        UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG,
+        UTF8_TWO_CONTS, UTF8_TWO_CONTS, UTF8_TWO_CONTS, UTF8_TWO_CONTS,
+        UTF8_TOO_SHORT | UTF8_OVERLONG_2,
+        UTF8_TOO_SHORT,
+        UTF8_TOO_SHORT | UTF8_OVERLONG_3 | UTF8_SURROGATE,
+        UTF8_TOO_SHORT | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000 | UTF8_OVERLONG_4
+    );
+
+    const __m128i byte_1_low_table = _mm_setr_epi8(
+        UTF8_CARRY | UTF8_OVERLONG_3 | UTF8_OVERLONG_2 | UTF8_OVERLONG_4,
+        UTF8_CARRY | UTF8_OVERLONG_2,
+        UTF8_CARRY,
+        UTF8_CARRY,
+        UTF8_CARRY | UTF8_TOO_LARGE,
+        UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+        UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+        UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+        UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+        UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+        UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+        UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+        UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+        UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000 | UTF8_SURROGATE,
+        UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+        UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000
+    );
+
+    const __m128i byte_2_high_table = _mm_setr_epi8(
+        UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT,
+        UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT,
+        UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_OVERLONG_3 | UTF8_TOO_LARGE_1000 | UTF8_OVERLONG_4,
+        UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_OVERLONG_3 | UTF8_TOO_LARGE,
+        UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_SURROGATE | UTF8_TOO_LARGE,
+        UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_SURROGATE | UTF8_TOO_LARGE,
+        UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT
+    );
+
+    const __m128i nibble_mask = _mm_set1_epi8(0x0f);
+    const __m128i byte_1_high = _mm_shuffle_epi8(byte_1_high_table, _mm_and_si128(_mm_srli_epi16(previous1, 4), nibble_mask));
+    const __m128i byte_1_low = _mm_shuffle_epi8(byte_1_low_table, _mm_and_si128(previous1, nibble_mask));
+    const __m128i byte_2_high = _mm_shuffle_epi8(byte_2_high_table, _mm_and_si128(_mm_srli_epi16(input, 4), nibble_mask));
+
+    return _mm_and_si128(_mm_and_si128(byte_1_high, byte_1_low), byte_2_high);
+}
+
+__attribute__((target("ssse3")))
+static void emit_utf8_block(Utf8_State* state, __m128i input) {
+    if (_mm_movemask_epi8(input) == 0) {
+        /* Pure ASCII; only a sequence left open by the previous block can be wrong. */
+        state->error = _mm_or_si128(state->error, state->incomplete);
+    }
+    else {
+        const __m128i previous1 = _mm_alignr_epi8(input, state->previous, 15);
+        const __m128i previous2 = _mm_alignr_epi8(input, state->previous, 14);
+        const __m128i previous3 = _mm_alignr_epi8(input, state->previous, 13);
+
+        const __m128i special_cases = emit_utf8_special_cases(input, previous1);
+
+        const __m128i third_byte = _mm_subs_epu8(previous2, _mm_set1_epi8((char)(0xe0 - 0x80)));
+        const __m128i fourth_byte = _mm_subs_epu8(previous3, _mm_set1_epi8((char)(0xf0 - 0x80)));
+        const __m128i must_be_continuation = _mm_and_si128(_mm_or_si128(third_byte, fourth_byte), _mm_set1_epi8((char)0x80));
+
+        state->error = _mm_or_si128(state->error, _mm_xor_si128(must_be_continuation, special_cases));
+
+        const __m128i incomplete_max = _mm_setr_epi8(
+            -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+            (char)(0xf0 - 1), (char)(0xe0 - 1), (char)(0xc0 - 1)
+        );
+
+        state->incomplete = _mm_subs_epu8(input, incomplete_max);
+    }
+
+    state->previous = input;
+}
+
+__attribute__((target("ssse3")))
+static int emit_utf8_check_ssse3(const unsigned char text[], size_t size) {
+    Utf8_State state;
+    state.error = _mm_setzero_si128();
+    state.previous = _mm_setzero_si128();
+    state.incomplete = _mm_setzero_si128();
+
+    size_t i = 0;
+    for (; i + 16 <= size; i += 16) {
+        emit_utf8_block(&state, _mm_loadu_si128((const __m128i*)(text + i)));
+    }
+
+    if (i < size) {
+        unsigned char tail[16] = {};
+        memcpy(tail, text + i, size - i);
+        emit_utf8_block(&state, _mm_loadu_si128((const __m128i*)tail));
+    }
+
+    const __m128i error = _mm_or_si128(state.error, state.incomplete);
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(error, _mm_setzero_si128())) == 0xffff;
+}
+
+#endif /* EMIT_SSE */
+
+static void emit_escape(Buffer* buffer, unsigned char c) {
+    switch (c) {
+        case '"':
+            buffer_append(buffer, "\\\"", 2);
+            break;
+        case '\\':
+            buffer_append(buffer, "\\\\", 2);
+            break;
+        case '\b':
+            buffer_append(buffer, "\\b", 2);
+            break;
+        case '\f':
+            buffer_append(buffer, "\\f", 2);
+            break;
+        case '\n':
+            buffer_append(buffer, "\\n", 2);
+            break;
+        case '\r':
+            buffer_append(buffer, "\\r", 2);
+            break;
+        case '\t':
+            buffer_append(buffer, "\\t", 2);
+            break;
+        default: {
+            const char escape[] = { '\\', 'u', '0', '0', s_hex_digits[c >> 4], s_hex_digits[c & 0x0f] };
+            buffer_append(buffer, escape, sizeof(escape));
+            break;
+        }
+    }
+}
+
+static int emit_needs_escape(unsigned char c) {
+    return c < 0x20 || c == '"' || c == '\\';
+}
+
+/*
+ * Exported functions
+ */
+
+void emit_force_scalar(int scalar) {
+    s_scalar = scalar;
+}
+
+int emit_utf8_check(const char text[], size_t size) {
+#ifdef EMIT_SSE
+    static int ssse3 = -1;
+    if (ssse3 < 0) {
+        ssse3 = __builtin_cpu_supports("ssse3") ? 1 : 0;
+    }
+
+    if (ssse3 && !s_scalar) {
+        return emit_utf8_check_ssse3((const unsigned char*)text, size);
+    }
+#endif
+
+    return emit_utf8_check_scalar((const unsigned char*)text, size);
+}
+
+/* Writes text as a quoted JSON string, escaped the same way as jansson's dump without flags. */
+void emit_string(Buffer* buffer, const char text[], size_t size) {
+    buffer_reserve(buffer, size + 2);
+    buffer_append_char(buffer, '"');
+
+    size_t i = 0;
+    size_t run = 0;
+
+#ifdef EMIT_SSE
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i backslash = _mm_set1_epi8('\\');
+    const __m128i control_max = _mm_set1_epi8(0x1f);
+
+    while (!s_scalar && i + 16 <= size) {
+        const __m128i input = _mm_loadu_si128((const __m128i*)(text + i));
+        const __m128i control = _mm_cmpeq_epi8(_mm_max_epu8(input, control_max), control_max);
+        const __m128i special = _mm_or_si128(
+            _mm_or_si128(_mm_cmpeq_epi8(input, quote), _mm_cmpeq_epi8(input, backslash)),
+            control
+        );
+
+        const int mask = _mm_movemask_epi8(special);
+        if (mask == 0) {
+            i += 16;
+            continue;
+        }
+
+        /* Copy the clean run up to the first special byte, then escape it. */
+        i += __builtin_ctz(mask);
+        buffer_append(buffer, text + run, i - run);
+        emit_escape(buffer, text[i]);
+        run = ++i;
+    }
+#endif
+
+    for (; i < size; ++i) {
+        if (emit_needs_escape(text[i])) {
+            buffer_append(buffer, text + run, i - run);
+            emit_escape(buffer, text[i]);
+            run = i + 1;
+        }
+    }
+
+    buffer_append(buffer, text + run, size - run);
+    buffer_append_char(buffer, '"');
+}
@@ -0,0 +1,35 @@
+/*
+ * Copyright (C) 2017  Alex Yatskov <alex@foosoft.net>
+ * Author: Alex Yatskov <alex@foosoft.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef EMIT_H
+#define EMIT_H
+
+#include <stddef.h>
+
+#include "buffer.h"
+
+/*
+ * Functions
+ */
+
+void emit_force_scalar(int scalar);
+int emit_utf8_check(const char text[], size_t size);
+void emit_string(Buffer* buffer, const char text[], size_t size);
+
+#endif /* EMIT_H */
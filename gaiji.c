@@ -0,0 +1,214 @@
+/*
+ * Copyright (C) 2017  Alex Yatskov <alex@foosoft.net>
+ * Author: Alex Yatskov <alex@foosoft.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "gaiji.h"
+#include "buffer.h"
+#include "convert.h"
+#include "util.h"
+
+/*
+ * Macros
+ */
+
+#define GAIJI_CODE_COUNT 0x10000
+
+/*
+ * Local types
+ */
+
+struct Gaiji_Map {
+    /* Offsets into the string pool plus one, indexed by font code; zero if unmapped. Each
+     * replacement is stored as its text followed by the text normalized as by --normalize. */
+    unsigned int offsets[2][GAIJI_CODE_COUNT];
+    unsigned int unmapped[2][GAIJI_CODE_COUNT];
+    Buffer       pool;
+};
+
+/*
+ * Local functions
+ */
+
+static void gaiji_append_code_point(Buffer* buffer, unsigned long code_point) {
+    if (code_point < 0x80) {
+        buffer_append_char(buffer, code_point);
+    }
+    else if (code_point < 0x800) {
+        buffer_append_char(buffer, 0xc0 | (code_point >> 6));
+        buffer_append_char(buffer, 0x80 | (code_point & 0x3f));
+    }
+    else if (code_point < 0x10000) {
+        buffer_append_char(buffer, 0xe0 | (code_point >> 12));
+        buffer_append_char(buffer, 0x80 | ((code_point >> 6) & 0x3f));
+        buffer_append_char(buffer, 0x80 | (code_point & 0x3f));
+    }
+    else {
+        buffer_append_char(buffer, 0xf0 | (code_point >> 18));
+        buffer_append_char(buffer, 0x80 | ((code_point >> 12) & 0x3f));
+        buffer_append_char(buffer, 0x80 | ((code_point >> 6) & 0x3f));
+        buffer_append_char(buffer, 0x80 | (code_point & 0x3f));
+    }
+}
+
+/*
+ * Parses a line such as "w_50275 U+3042" or "n_41243 ⅰ"; the key matches the
+ * placeholder written for unmapped glyphs, and the replacement is either
+ * literal UTF-8 text or a sequence of U+XXXX code points.
+ */
+
+static int gaiji_parse_line(Gaiji_Map* map, char line[]) {
+    char* cursor = line;
+    while (isspace((unsigned char)*cursor)) {
+        ++cursor;
+    }
+
+    if (*cursor == 0 || *cursor == '#') {
+        return 1;
+    }
+
+    Gaiji_Width width;
+    if (cursor[0] == 'n' && cursor[1] == '_') {
+        width = GAIJI_NARROW;
+    }
+    else if (cursor[0] == 'w' && cursor[1] == '_') {
+        width = GAIJI_WIDE;
+    }
+    else {
+        return 0;
+    }
+
+    char* end = NULL;
+    const unsigned long code = strtoul(cursor + 2, &end, 0);
+    if (end == cursor + 2 || code >= GAIJI_CODE_COUNT || !isspace((unsigned char)*end)) {
+        return 0;
+    }
+
+    cursor = end;
+    while (isspace((unsigned char)*cursor)) {
+        ++cursor;
+    }
+
+    end = cursor + strlen(cursor);
+    while (end > cursor && isspace((unsigned char)end[-1])) {
+        *--end = 0;
+    }
+
+    if (*cursor == 0) {
+        return 0;
+    }
+
+    const size_t offset = map->pool.size;
+    if (cursor[0] == 'U' && cursor[1] == '+') {
+        while (*cursor != 0) {
+            if (cursor[0] != 'U' || cursor[1] != '+') {
+                map->pool.size = offset;
+                return 0;
+            }
+
+            const unsigned long code_point = strtoul(cursor + 2, &end, 16);
+            if (end == cursor + 2 || code_point > 0x10ffff) {
+                map->pool.size = offset;
+                return 0;
+            }
+
+            gaiji_append_code_point(&map->pool, code_point);
+            for (cursor = end; isspace((unsigned char)*cursor); ++cursor);
+        }
+    }
+    else {
+        buffer_append_string(&map->pool, cursor);
+    }
+
+    buffer_append_char(&map->pool, 0);
+
+    char* normalized = utf8_normalize(map->pool.data + offset);
+    buffer_append_string(&map->pool, normalized);
+    buffer_append_char(&map->pool, 0);
+    free(normalized);
+
+    map->offsets[width][code] = offset + 1;
+    return 1;
+}
+
+/*
+ * Exported functions
+ */
+
+Gaiji_Map* gaiji_map_load(const char path[]) {
+    FILE* fp = fopen(path, "r");
+    if (fp == NULL) {
+        fprintf(stderr, "error: failed to open gaiji map (%s)\n", path);
+        return NULL;
+    }
+
+    Gaiji_Map* map = calloc(1, sizeof(Gaiji_Map));
+
+    char line[1024];
+    int line_number = 0;
+    while (fgets(line, ARRSIZE(line), fp) != NULL) {
+        ++line_number;
+        if (!gaiji_parse_line(map, line)) {
+            fprintf(stderr, "error: invalid gaiji map entry (%s:%d)\n", path, line_number);
+            gaiji_map_destroy(map);
+            fclose(fp);
+            return NULL;
+        }
+    }
+
+    fclose(fp);
+    return map;
+}
+
+void gaiji_map_destroy(Gaiji_Map* map) {
+    buffer_free(&map->pool);
+    free(map);
+}
+
+const char* gaiji_map_lookup(Gaiji_Map* map, Gaiji_Width width, unsigned int code) {
+    if (code >= GAIJI_CODE_COUNT) {
+        return NULL;
+    }
+
+    const unsigned int offset = map->offsets[width][code];
+    if (offset == 0) {
+        ++map->unmapped[width][code];
+        return NULL;
+    }
+
+    return map->pool.data + offset - 1;
+}
+
+/* Returns the normalized form of a replacement returned by gaiji_map_lookup. */
+const char* gaiji_map_normalized(const char replacement[]) {
+    return replacement + strlen(replacement) + 1;
+}
+
+void gaiji_map_report(const Gaiji_Map* map, FILE* fp) {
+    const char prefixes[] = { 'n', 'w' };
+    for (int width = GAIJI_NARROW; width <= GAIJI_WIDE; ++width) {
+        for (unsigned int code = 0; code < GAIJI_CODE_COUNT; ++code) {
+            const unsigned int count = map->unmapped[width][code];
+            if (count > 0) {
+                fprintf(fp, "warning: unmapped gaiji {{%c_%u}} used %u times\n", prefixes[width], code, count);
+            }
+        }
+    }
+}
@@ -0,0 +1,46 @@
+/*
+ * Copyright (C) 2017  Alex Yatskov <alex@foosoft.net>
+ * Author: Alex Yatskov <alex@foosoft.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef GAIJI_H
+#define GAIJI_H
+
+#include <stdio.h>
+
+/*
+ * Types
+ */
+
+typedef enum {
+    GAIJI_NARROW,
+    GAIJI_WIDE,
+} Gaiji_Width;
+
+typedef struct Gaiji_Map Gaiji_Map;
+
+/*
+ * Functions
+ */
+
+Gaiji_Map* gaiji_map_load(const char path[]);
+void gaiji_map_destroy(Gaiji_Map* map);
+const char* gaiji_map_lookup(Gaiji_Map* map, Gaiji_Width width, unsigned int code);
+const char* gaiji_map_normalized(const char replacement[]);
+void gaiji_map_report(const Gaiji_Map* map, FILE* fp);
+
+#endif /* GAIJI_H */
@@ -0,0 +1,170 @@
+/*
+ * Copyright (C) 2017  Alex Yatskov <alex@foosoft.net>
+ * Author: Alex Yatskov <alex@foosoft.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <string.h>
+
+#include "hash.h"
+
+/*
+ * Macros
+ */
+
+#define HASH_PRIME_1 0x9e3779b185ebca87ULL
+#define HASH_PRIME_2 0xc2b2ae3d27d4eb4fULL
+#define HASH_PRIME_3 0x165667b19e3779f9ULL
+#define HASH_PRIME_4 0x85ebca77c2b2ae63ULL
+#define HASH_PRIME_5 0x27d4eb2f165667c5ULL
+
+/*
+ * Local functions
+ */
+
+static uint64_t hash_rotate(uint64_t value, int bits) {
+    return value << bits | value >> (64 - bits);
+}
+
+static uint64_t hash_read64(const char data[]) {
+    const unsigned char* bytes = (const unsigned char*)data;
+    uint64_t value = 0;
+    for (int i = 7; i >= 0; --i) {
+        value = value << 8 | bytes[i];
+    }
+
+    return value;
+}
+
+static uint64_t hash_read32(const char data[]) {
+    const unsigned char* bytes = (const unsigned char*)data;
+    return bytes[0] | bytes[1] << 8 | bytes[2] << 16 | (uint64_t)bytes[3] << 24;
+}
+
+static uint64_t hash_round(uint64_t lane, uint64_t input) {
+    lane += input * HASH_PRIME_2;
+    lane = hash_rotate(lane, 31);
+    return lane * HASH_PRIME_1;
+}
+
+static uint64_t hash_merge(uint64_t hash, uint64_t lane) {
+    hash ^= hash_round(0, lane);
+    return hash * HASH_PRIME_1 + HASH_PRIME_4;
+}
+
+static void hash_stripe(Hash_State* state, const char data[]) {
+    for (int i = 0; i < 4; ++i) {
+        state->lanes[i] = hash_round(state->lanes[i], hash_read64(data + i * 8));
+    }
+}
+
+/*
+ * Exported functions
+ */
+
+/*
+ * XXH64, as specified by the xxHash project, fed incrementally; the result
+ * equals hash_xxh64 over all of the data given to hash_update.
+ */
+
+void hash_init(Hash_State* state, uint64_t seed) {
+    memset(state, 0, sizeof(Hash_State));
+    state->seed = seed;
+    state->lanes[0] = seed + HASH_PRIME_1 + HASH_PRIME_2;
+    state->lanes[1] = seed + HASH_PRIME_2;
+    state->lanes[2] = seed;
+    state->lanes[3] = seed - HASH_PRIME_1;
+}
+
+void hash_update(Hash_State* state, const char data[], size_t size) {
+    state->total += size;
+
+    if (state->pending_size + size < sizeof(state->pending)) {
+        memcpy(state->pending + state->pending_size, data, size);
+        state->pending_size += size;
+        return;
+    }
+
+    if (state->pending_size > 0) {
+        const size_t fill = sizeof(state->pending) - state->pending_size;
+        memcpy(state->pending + state->pending_size, data, fill);
+        hash_stripe(state, state->pending);
+        data += fill;
+        size -= fill;
+        state->pending_size = 0;
+    }
+
+    for (; size >= sizeof(state->pending); data += sizeof(state->pending), size -= sizeof(state->pending)) {
+        hash_stripe(state, data);
+    }
+
+    memcpy(state->pending, data, size);
+    state->pending_size = size;
+}
+
+uint64_t hash_finish(const Hash_State* state) {
+    uint64_t hash = 0;
+    if (state->total >= sizeof(state->pending)) {
+        hash =
+            hash_rotate(state->lanes[0], 1) +
+            hash_rotate(state->lanes[1], 7) +
+            hash_rotate(state->lanes[2], 12) +
+            hash_rotate(state->lanes[3], 18);
+
+        for (int i = 0; i < 4; ++i) {
+            hash = hash_merge(hash, state->lanes[i]);
+        }
+    }
+    else {
+        hash = state->seed + HASH_PRIME_5;
+    }
+
+    hash += state->total;
+
+    const char* data = state->pending;
+    size_t size = state->pending_size;
+    for (; size >= 8; data += 8, size -= 8) {
+        hash ^= hash_round(0, hash_read64(data));
+        hash = hash_rotate(hash, 27) * HASH_PRIME_1 + HASH_PRIME_4;
+    }
+
+    if (size >= 4) {
+        hash ^= hash_read32(data) * HASH_PRIME_1;
+        hash = hash_rotate(hash, 23) * HASH_PRIME_2 + HASH_PRIME_3;
+        data += 4;
+        size -= 4;
+    }
+
+    for (; size > 0; ++data, --size) {
+        hash ^= (unsigned char)*data * HASH_PRIME_5;
+        hash = hash_rotate(hash, 11) * HASH_PRIME_1;
+    }
+
+    hash ^= hash >> 33;
+    hash *= HASH_PRIME_2;
+    hash ^= hash >> 29;
+    hash *= HASH_PRIME_3;
+    hash ^= hash >> 32;
+
+    return hash;
+}
+
+uint64_t hash_xxh64(const char data[], size_t size, uint64_t seed) {
+    Hash_State state;
+    hash_init(&state, seed);
+    hash_update(&state, data, size);
+    return hash_finish(&state);
+}
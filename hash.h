@@ -0,0 +1,47 @@
+/*
+ * Copyright (C) 2017  Alex Yatskov <alex@foosoft.net>
+ * Author: Alex Yatskov <alex@foosoft.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef HASH_H
+#define HASH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Types
+ */
+
+typedef struct Hash_State {
+    uint64_t lanes[4];
+    uint64_t seed;
+    uint64_t total;
+    char     pending[32];
+    size_t   pending_size;
+} Hash_State;
+
+/*
+ * Functions
+ */
+
+void hash_init(Hash_State* state, uint64_t seed);
+void hash_update(Hash_State* state, const char data[], size_t size);
+uint64_t hash_finish(const Hash_State* state);
+uint64_t hash_xxh64(const char data[], size_t size, uint64_t seed);
+
+#endif /* HASH_H */
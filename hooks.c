@@ -18,8 +18,11 @@
 
 #include <assert.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include "hooks.h"
+#include "buffer.h"
 #include "util.h"
 
 #include "eb/eb/eb.h"
@@ -29,6 +32,9 @@
  * Macros
  */
 
+#define HOOK_SPAN_SENTINEL 0x1f
+#define HOOK_GAIJI_SENTINEL 0x1e
+
 #define HOOK_FUNC_NAME(NAME) hook_##NAME
 
 #define HOOK_TAGGER(NAME) \
@@ -49,6 +55,86 @@
         return 0;\
     }
 
+/*
+ * Local types
+ */
+
+typedef enum {
+    HOOK_EVENT_BEGIN,
+    HOOK_EVENT_END,
+    HOOK_EVENT_POINT,
+} Hook_Event;
+
+typedef struct Hook_Markup_Attr {
+    const char* name;
+    int         index;
+} Hook_Markup_Attr;
+
+typedef struct Hook_Markup {
+    EB_Hook_Code     code;
+    Hook_Event       event;
+    const char*      type;
+    const char*      group;
+    Hook_Markup_Attr attrs[4];
+} Hook_Markup;
+
+/*
+ * Local data
+ */
+
+/*
+ * Spans are named after their begin hook; end hooks close the most recent
+ * open span of the same group, and may add attributes of their own.
+ */
+
+static const Hook_Markup s_markup_spans[] = {
+    { EB_HOOK_BEGIN_CANDIDATE,         HOOK_EVENT_BEGIN, "candidate",         NULL,               {} },
+    { EB_HOOK_BEGIN_CLICKABLE_AREA,    HOOK_EVENT_BEGIN, "clickable_area",    NULL,               {} },
+    { EB_HOOK_BEGIN_COLOR_BMP,         HOOK_EVENT_BEGIN, "color_bmp",         "color_graphic",    { { "page", 2 }, { "offset", 3 } } },
+    { EB_HOOK_BEGIN_COLOR_JPEG,        HOOK_EVENT_BEGIN, "color_jpeg",        "color_graphic",    { { "page", 2 }, { "offset", 3 } } },
+    { EB_HOOK_BEGIN_DECORATION,        HOOK_EVENT_BEGIN, "decoration",        NULL,               { { "decoration", 1 } } },
+    { EB_HOOK_BEGIN_EBXAC_GAIJI,       HOOK_EVENT_BEGIN, "ebxac_gaiji",       NULL,               {} },
+    { EB_HOOK_BEGIN_EMPHASIS,          HOOK_EVENT_BEGIN, "emphasis",          NULL,               {} },
+    { EB_HOOK_BEGIN_GRAPHIC_REFERENCE, HOOK_EVENT_BEGIN, "graphic_reference", NULL,               {} },
+    { EB_HOOK_BEGIN_GRAY_GRAPHIC,      HOOK_EVENT_BEGIN, "gray_graphic",      NULL,               {} },
+    { EB_HOOK_BEGIN_IMAGE_PAGE,        HOOK_EVENT_BEGIN, "image_page",        NULL,               {} },
+    { EB_HOOK_BEGIN_IN_COLOR_BMP,      HOOK_EVENT_BEGIN, "in_color_bmp",      "in_color_graphic", { { "page", 2 }, { "offset", 3 } } },
+    { EB_HOOK_BEGIN_IN_COLOR_JPEG,     HOOK_EVENT_BEGIN, "in_color_jpeg",     "in_color_graphic", { { "page", 2 }, { "offset", 3 } } },
+    { EB_HOOK_BEGIN_KEYWORD,           HOOK_EVENT_BEGIN, "keyword",           NULL,               {} },
+    { EB_HOOK_BEGIN_MONO_GRAPHIC,      HOOK_EVENT_BEGIN, "mono_graphic",      NULL,               { { "height", 2 }, { "width", 3 } } },
+    { EB_HOOK_BEGIN_MPEG,              HOOK_EVENT_BEGIN, "mpeg",              NULL,               {} },
+    { EB_HOOK_BEGIN_NARROW,            HOOK_EVENT_BEGIN, "narrow",            NULL,               {} },
+    { EB_HOOK_BEGIN_NO_NEWLINE,        HOOK_EVENT_BEGIN, "no_newline",        NULL,               {} },
+    { EB_HOOK_BEGIN_REFERENCE,         HOOK_EVENT_BEGIN, "reference",         NULL,               {} },
+    { EB_HOOK_BEGIN_SUBSCRIPT,         HOOK_EVENT_BEGIN, "subscript",         NULL,               {} },
+    { EB_HOOK_BEGIN_SUPERSCRIPT,       HOOK_EVENT_BEGIN, "superscript",       NULL,               {} },
+    { EB_HOOK_BEGIN_UNICODE,           HOOK_EVENT_BEGIN, "unicode",           NULL,               {} },
+    { EB_HOOK_BEGIN_WAVE,              HOOK_EVENT_BEGIN, "wave",              NULL,               { { "startPage", 2 }, { "startOffset", 3 }, { "endPage", 4 }, { "endOffset", 5 } } },
+    { EB_HOOK_END_CANDIDATE_GROUP,     HOOK_EVENT_END,   "candidate",         NULL,               { { "page", 1 }, { "offset", 2 } } },
+    { EB_HOOK_END_CANDIDATE_LEAF,      HOOK_EVENT_END,   "candidate",         NULL,               {} },
+    { EB_HOOK_END_CLICKABLE_AREA,      HOOK_EVENT_END,   "clickable_area",    NULL,               {} },
+    { EB_HOOK_END_COLOR_GRAPHIC,       HOOK_EVENT_END,   "color_graphic",     NULL,               {} },
+    { EB_HOOK_END_DECORATION,          HOOK_EVENT_END,   "decoration",        NULL,               {} },
+    { EB_HOOK_END_EBXAC_GAIJI,         HOOK_EVENT_END,   "ebxac_gaiji",       NULL,               {} },
+    { EB_HOOK_END_EMPHASIS,            HOOK_EVENT_END,   "emphasis",          NULL,               {} },
+    { EB_HOOK_END_GRAPHIC_REFERENCE,   HOOK_EVENT_END,   "graphic_reference", NULL,               { { "page", 1 }, { "offset", 2 } } },
+    { EB_HOOK_END_GRAY_GRAPHIC,        HOOK_EVENT_END,   "gray_graphic",      NULL,               { { "page", 1 }, { "offset", 2 } } },
+    { EB_HOOK_END_IMAGE_PAGE,          HOOK_EVENT_END,   "image_page",        NULL,               {} },
+    { EB_HOOK_END_IN_COLOR_GRAPHIC,    HOOK_EVENT_END,   "in_color_graphic",  NULL,               {} },
+    { EB_HOOK_END_KEYWORD,             HOOK_EVENT_END,   "keyword",           NULL,               {} },
+    { EB_HOOK_END_MONO_GRAPHIC,        HOOK_EVENT_END,   "mono_graphic",      NULL,               { { "page", 1 }, { "offset", 2 } } },
+    { EB_HOOK_END_MPEG,                HOOK_EVENT_END,   "mpeg",              NULL,               {} },
+    { EB_HOOK_END_NARROW,              HOOK_EVENT_END,   "narrow",            NULL,               {} },
+    { EB_HOOK_END_NO_NEWLINE,          HOOK_EVENT_END,   "no_newline",        NULL,               {} },
+    { EB_HOOK_END_REFERENCE,           HOOK_EVENT_END,   "reference",         NULL,               { { "page", 1 }, { "offset", 2 } } },
+    { EB_HOOK_END_SUBSCRIPT,           HOOK_EVENT_END,   "subscript",         NULL,               {} },
+    { EB_HOOK_END_SUPERSCRIPT,         HOOK_EVENT_END,   "superscript",       NULL,               {} },
+    { EB_HOOK_END_UNICODE,             HOOK_EVENT_END,   "unicode",           NULL,               {} },
+    { EB_HOOK_END_WAVE,                HOOK_EVENT_END,   "wave",              NULL,               {} },
+    { EB_HOOK_GRAPHIC_REFERENCE,       HOOK_EVENT_POINT, "graphic_reference", NULL,               { { "page", 1 }, { "offset", 2 } } },
+    { EB_HOOK_SET_INDENT,              HOOK_EVENT_POINT, "indent",            NULL,               { { "indent", 1 } } },
+};
+
 /*
  * Local functions
  */
@@ -121,6 +207,169 @@ static EB_Error_Code hook_end_reference( /* EB_HOOK_END_REFERENCE */
     return 0;
 }
 
+static EB_Error_Code hook_markup_span(
+    EB_Book*           book,
+    EB_Appendix*       appendix,
+    void*              container,
+    EB_Hook_Code       code,
+    int                argc,
+    const unsigned int argv[]
+);
+
+static EB_Error_Code hook_reference_record( /* EB_HOOK_END_REFERENCE */
+    EB_Book*           book,
+    EB_Appendix*       appendix,
+    void*              container,
+    EB_Hook_Code       code,
+    int                argc,
+    const unsigned int argv[]
+) {
+    Hook_Context* context = container;
+    if (context == NULL) {
+        return 0;
+    }
+
+    if (argc >= 3) {
+        if (context->reference_count == context->reference_alloc) {
+            context->reference_alloc = context->reference_alloc == 0 ? 16 : context->reference_alloc * 2;
+            context->references = realloc(context->references, context->reference_alloc * sizeof(Hook_Reference));
+        }
+
+        Hook_Reference* reference = context->references + context->reference_count++;
+        reference->page = argv[1];
+        reference->offset = argv[2];
+    }
+
+    /* Recording replaces the markup hook for this code, so forward to it. */
+    if (context->flags & FLAG_MARKUP_SPANS) {
+        return hook_markup_span(book, appendix, container, code, argc, argv);
+    }
+
+    if (context->flags & FLAG_HOOK_MARKUP) {
+        return hook_end_reference(book, appendix, container, code, argc, argv);
+    }
+
+    return 0;
+}
+
+static EB_Error_Code hook_media_record( /* EB_HOOK_BEGIN_COLOR_BMP, EB_HOOK_BEGIN_WAVE, ... */
+    EB_Book*           book,
+    EB_Appendix*       appendix,
+    void*              container,
+    EB_Hook_Code       code,
+    int                argc,
+    const unsigned int argv[]
+) {
+    Hook_Context* context = container;
+    if (context == NULL) {
+        return 0;
+    }
+
+    Hook_Media media = {};
+    int arg_count = 4;
+    EB_Error_Code (*tagger)(EB_Book*, EB_Appendix*, void*, EB_Hook_Code, int, const unsigned int[]) = NULL;
+
+    switch (code) {
+        case EB_HOOK_BEGIN_COLOR_BMP:
+            media.type = HOOK_MEDIA_COLOR_BMP;
+            arg_count = 2;
+            tagger = HOOK_FUNC_NAME(begin_color_bmp);
+            break;
+        case EB_HOOK_BEGIN_IN_COLOR_BMP:
+            media.type = HOOK_MEDIA_COLOR_BMP;
+            arg_count = 2;
+            tagger = HOOK_FUNC_NAME(begin_in_color_bmp);
+            break;
+        case EB_HOOK_BEGIN_COLOR_JPEG:
+            media.type = HOOK_MEDIA_COLOR_JPEG;
+            arg_count = 2;
+            tagger = HOOK_FUNC_NAME(begin_color_jpeg);
+            break;
+        case EB_HOOK_BEGIN_IN_COLOR_JPEG:
+            media.type = HOOK_MEDIA_COLOR_JPEG;
+            arg_count = 2;
+            tagger = HOOK_FUNC_NAME(begin_in_color_jpeg);
+            break;
+        case EB_HOOK_BEGIN_WAVE:
+            media.type = HOOK_MEDIA_WAVE;
+            tagger = HOOK_FUNC_NAME(begin_wave);
+            break;
+        case EB_HOOK_BEGIN_MPEG:
+            media.type = HOOK_MEDIA_MPEG;
+            tagger = HOOK_FUNC_NAME(begin_mpeg);
+            break;
+        default:
+            return 0;
+    }
+
+    if (argc >= 2 + arg_count) {
+        for (int i = 0; i < arg_count; ++i) {
+            media.args[i] = argv[2 + i];
+        }
+
+        if (context->media_count == context->media_alloc) {
+            context->media_alloc = context->media_alloc == 0 ? 4 : context->media_alloc * 2;
+            context->media = realloc(context->media, context->media_alloc * sizeof(Hook_Media));
+        }
+
+        context->media[context->media_count++] = media;
+    }
+
+    /* Recording replaces the markup hook for this code, so forward to it. */
+    if (context->flags & FLAG_MARKUP_SPANS) {
+        return hook_markup_span(book, appendix, container, code, argc, argv);
+    }
+
+    if (context->flags & FLAG_HOOK_MARKUP) {
+        return tagger(book, appendix, container, code, argc, argv);
+    }
+
+    return 0;
+}
+
+static int hooks_write_gaiji(EB_Book* book, void* container, Gaiji_Width width, unsigned int code) {
+    Hook_Context* context = container;
+    if (context == NULL || context->gaiji_map == NULL) {
+        return 0;
+    }
+
+    const char* replacement = gaiji_map_lookup(context->gaiji_map, width, code);
+    if (replacement == NULL) {
+        return 0;
+    }
+
+    if (context->gaiji_count == context->gaiji_alloc) {
+        context->gaiji_alloc = context->gaiji_alloc == 0 ? 16 : context->gaiji_alloc * 2;
+        context->gaiji = realloc(context->gaiji, context->gaiji_alloc * sizeof(char*));
+    }
+
+    /*
+     * The replacement is already UTF-8 and cannot go through the EUC-JP
+     * conversion, so only a sentinel is written here; see hooks_resolve.
+     */
+
+    context->gaiji[context->gaiji_count++] = replacement;
+    eb_write_text_byte1(book, HOOK_GAIJI_SENTINEL);
+    return 1;
+}
+
+/* With --fonts-used, glyphs written as markers are noted so that only their bitmaps are imported. */
+static void hooks_record_glyph(void* container, Gaiji_Width width, unsigned int code) {
+    Hook_Context* context = container;
+    if (context == NULL || !(context->flags & FLAG_FONTS_USED)) {
+        return;
+    }
+
+    if (context->glyph_count == context->glyph_alloc) {
+        context->glyph_alloc = context->glyph_alloc == 0 ? 16 : context->glyph_alloc * 2;
+        context->glyphs = realloc(context->glyphs, context->glyph_alloc * sizeof(Hook_Glyph));
+    }
+
+    Hook_Glyph* glyph = context->glyphs + context->glyph_count++;
+    glyph->width = width;
+    glyph->code = code;
+}
+
 static EB_Error_Code hook_narrow_font( /* EB_HOOK_NARROW_FONT */
     EB_Book*           book,
     EB_Appendix*       appendix,
@@ -130,13 +379,17 @@ static EB_Error_Code hook_narrow_font( /* EB_HOOK_NARROW_FONT */
     const unsigned int argv[]
 ) {
     (void)appendix;
-    (void)container;
     (void)code;
 
-    char stub[32];
     assert(argc >= 1);
+    if (hooks_write_gaiji(book, container, GAIJI_NARROW, argv[0])) {
+        return 0;
+    }
+
+    char stub[32];
     snprintf(stub, ARRSIZE(stub), "{{n_%u}}", argv[0]);
     stub[ARRSIZE(stub) - 1] = 0;
+    hooks_record_glyph(container, GAIJI_NARROW, argv[0]);
 
     eb_write_text_string(book, stub);
     return 0;
@@ -151,18 +404,91 @@ static EB_Error_Code hook_wide_font( /* EB_HOOK_WIDE_FONT */
     const unsigned int argv[]
 ) {
     (void)appendix;
-    (void)container;
     (void)code;
 
-    char stub[32];
     assert(argc >= 1);
+    if (hooks_write_gaiji(book, container, GAIJI_WIDE, argv[0])) {
+        return 0;
+    }
+
+    char stub[32];
     snprintf(stub, ARRSIZE(stub), "{{w_%u}}", argv[0]);
     stub[ARRSIZE(stub) - 1] = 0;
+    hooks_record_glyph(container, GAIJI_WIDE, argv[0]);
 
     eb_write_text_string(book, stub);
     return 0;
 }
 
+static void hooks_span_attrs(Hook_Span* span, const Hook_Markup* markup, int argc, const unsigned int argv[]) {
+    for (unsigned i = 0; i < ARRSIZE(markup->attrs) && markup->attrs[i].name != NULL; ++i) {
+        const int index = markup->attrs[i].index;
+        if (index < argc && span->attr_count < HOOK_SPAN_MAX_ATTRS) {
+            Hook_Span_Attr* attr = span->attrs + span->attr_count++;
+            attr->name = markup->attrs[i].name;
+            attr->value = argv[index];
+        }
+    }
+}
+
+static EB_Error_Code hook_markup_span(
+    EB_Book*           book,
+    EB_Appendix*       appendix,
+    void*              container,
+    EB_Hook_Code       code,
+    int                argc,
+    const unsigned int argv[]
+) {
+    (void)appendix;
+
+    Hook_Context* context = container;
+    if (context == NULL) {
+        return 0;
+    }
+
+    const Hook_Markup* markup = NULL;
+    for (unsigned i = 0; i < ARRSIZE(s_markup_spans); ++i) {
+        if (s_markup_spans[i].code == code) {
+            markup = s_markup_spans + i;
+            break;
+        }
+    }
+
+    if (markup == NULL) {
+        return 0;
+    }
+
+    const int event = context->event_count++;
+    if (markup->event == HOOK_EVENT_END) {
+        for (int i = context->span_count - 1; i >= 0; --i) {
+            Hook_Span* span = context->spans + i;
+            if (span->end < 0 && strcmp(span->group, markup->type) == 0) {
+                span->end = event;
+                hooks_span_attrs(span, markup, argc, argv);
+                break;
+            }
+        }
+    }
+    else {
+        if (context->span_count == context->span_alloc) {
+            context->span_alloc = context->span_alloc == 0 ? 16 : context->span_alloc * 2;
+            context->spans = realloc(context->spans, context->span_alloc * sizeof(Hook_Span));
+        }
+
+        Hook_Span* span = context->spans + context->span_count++;
+        memset(span, 0, sizeof(Hook_Span));
+        span->type = markup->type;
+        span->group = markup->group != NULL ? markup->group : markup->type;
+        span->start = event;
+        span->end = markup->event == HOOK_EVENT_POINT ? event : -1;
+        hooks_span_attrs(span, markup, argc, argv);
+    }
+
+    /* Marks where the event happened, see hooks_resolve. */
+    eb_write_text_byte1(book, HOOK_SPAN_SENTINEL);
+    return 0;
+}
+
 /*
  * Local data
  */
@@ -231,9 +557,200 @@ void hooks_install(EB_Hookset* hookset, int flags) {
         eb_set_hook(hookset, s_hooks_basic + i);
     }
 
-    if (flags & FLAG_HOOK_MARKUP) {
+    if (flags & FLAG_MARKUP_SPANS) {
+        for (unsigned i = 0; i < ARRSIZE(s_markup_spans); ++i) {
+            const EB_Hook hook = { s_markup_spans[i].code, hook_markup_span };
+            eb_set_hook(hookset, &hook);
+        }
+    }
+    else if (flags & FLAG_HOOK_MARKUP) {
         for (unsigned i = 0; i < ARRSIZE(s_hooks_markup); ++i) {
             eb_set_hook(hookset, s_hooks_markup + i);
         }
     }
+
+    if (flags & FLAG_REFERENCES) {
+        const EB_Hook hook = { EB_HOOK_END_REFERENCE, hook_reference_record };
+        eb_set_hook(hookset, &hook);
+    }
+
+    if (flags & FLAG_MEDIA) {
+        const EB_Hook_Code codes[] = {
+            EB_HOOK_BEGIN_COLOR_BMP,
+            EB_HOOK_BEGIN_COLOR_JPEG,
+            EB_HOOK_BEGIN_IN_COLOR_BMP,
+            EB_HOOK_BEGIN_IN_COLOR_JPEG,
+            EB_HOOK_BEGIN_WAVE,
+            EB_HOOK_BEGIN_MPEG,
+        };
+
+        for (unsigned i = 0; i < ARRSIZE(codes); ++i) {
+            const EB_Hook hook = { codes[i], hook_media_record };
+            eb_set_hook(hookset, &hook);
+        }
+    }
+}
+
+void hooks_context_reset(Hook_Context* context) {
+    context->span_count = 0;
+    context->event_count = 0;
+    context->gaiji_count = 0;
+    context->reference_count = 0;
+    context->media_count = 0;
+    context->glyph_count = 0;
+}
+
+void hooks_context_free(Hook_Context* context) {
+    free(context->spans);
+    free(context->events);
+    free(context->gaiji);
+    free(context->references);
+    free(context->media);
+    free(context->glyphs);
+    memset(context, 0, sizeof(Hook_Context));
+}
+
+/*
+ * Removes the sentinels written by the hooks from the converted text: span
+ * event sentinels are dropped and their code point offsets recorded, and gaiji
+ * sentinels are replaced with their mapped text. Returns the resolved text,
+ * which is reallocated if it had to grow.
+ */
+
+char* hooks_resolve(Hook_Context* context, char text[]) {
+    if (context->event_count == 0 && context->gaiji_count == 0) {
+        return text;
+    }
+
+    if (context->event_alloc < context->event_count) {
+        context->event_alloc = context->event_count;
+        context->events = realloc(context->events, context->event_alloc * sizeof(int));
+    }
+
+    /* Replacements are normalized along with the text they go into. */
+    const int normalize = context->flags & FLAG_NORMALIZE;
+
+    size_t growth = 0;
+    for (int i = 0; i < context->gaiji_count; ++i) {
+        const size_t length = strlen(normalize ? gaiji_map_normalized(context->gaiji[i]) : context->gaiji[i]);
+        growth += length > 1 ? length - 1 : 0;
+    }
+
+    char* output_text = growth > 0 ? malloc(strlen(text) + growth + 1) : text;
+    char* output = output_text;
+
+    int position = 0;
+    int event = 0;
+    int gaiji = 0;
+
+    for (const char* input = text; *input != 0; ++input) {
+        if (*input == HOOK_SPAN_SENTINEL && event < context->event_count) {
+            context->events[event++] = position;
+            continue;
+        }
+
+        if (*input == HOOK_GAIJI_SENTINEL && gaiji < context->gaiji_count) {
+            const char* replacement = context->gaiji[gaiji++];
+            if (normalize) {
+                replacement = gaiji_map_normalized(replacement);
+            }
+
+            for (; *replacement != 0; ++replacement) {
+                if ((*replacement & 0xc0) != 0x80) {
+                    ++position;
+                }
+
+                *output++ = *replacement;
+            }
+
+            continue;
+        }
+
+        if ((*input & 0xc0) != 0x80) {
+            ++position;
+        }
+
+        *output++ = *input;
+    }
+
+    *output = 0;
+
+    if (output_text != text) {
+        free(text);
+    }
+
+    /* Events past the end of a truncated read are pinned to the end. */
+    while (event < context->event_count) {
+        context->events[event++] = position;
+    }
+
+    for (int i = 0; i < context->span_count; ++i) {
+        Hook_Span* span = context->spans + i;
+        span->start = context->events[span->start];
+        span->end = span->end < 0 ? position : context->events[span->end];
+    }
+
+    return output_text;
+}
+
+/*
+ * Like hooks_resolve but leaves the spans alone, and also drops inline markup
+ * tags; used for the heading keys. Takes ownership of the text.
+ */
+
+char* hooks_strip(const Hook_Context* context, char text[]) {
+    Buffer output = {};
+    int gaiji = 0;
+
+    for (const char* input = text; *input != 0; ++input) {
+        if (*input == HOOK_SPAN_SENTINEL) {
+            continue;
+        }
+
+        /* Keys are always normalized, and so are the replacements in them. */
+        if (*input == HOOK_GAIJI_SENTINEL && gaiji < context->gaiji_count) {
+            buffer_append_string(&output, gaiji_map_normalized(context->gaiji[gaiji++]));
+            continue;
+        }
+
+        if (*input == '<' && (context->flags & FLAG_HOOK_MARKUP)) {
+            while (input[1] != 0 && *input != '>') {
+                ++input;
+            }
+
+            continue;
+        }
+
+        buffer_append_char(&output, *input);
+    }
+
+    buffer_append_char(&output, 0);
+    free(text);
+    return output.data;
+}
+
+/*
+ * Maps a span type, group or attribute name back to the string that spans
+ * refer to, so spans read back from a saved part compare and print the same.
+ */
+
+const char* hooks_span_name(const char name[]) {
+    for (unsigned i = 0; i < ARRSIZE(s_markup_spans); ++i) {
+        const Hook_Markup* markup = s_markup_spans + i;
+        if (strcmp(markup->type, name) == 0) {
+            return markup->type;
+        }
+
+        if (markup->group != NULL && strcmp(markup->group, name) == 0) {
+            return markup->group;
+        }
+
+        for (unsigned j = 0; j < ARRSIZE(markup->attrs) && markup->attrs[j].name != NULL; ++j) {
+            if (strcmp(markup->attrs[j].name, name) == 0) {
+                return markup->attrs[j].name;
+            }
+        }
+    }
+
+    return NULL;
 }
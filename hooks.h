@@ -19,12 +19,94 @@
 #ifndef HOOKS_H
 #define HOOKS_H
 
+#include "gaiji.h"
+
 #include "eb/eb/eb.h"
 
+/*
+ * Macros
+ */
+
+#define HOOK_SPAN_MAX_ATTRS 6
+
+/*
+ * Types
+ */
+
+typedef struct Hook_Span_Attr {
+    const char*  name;
+    unsigned int value;
+} Hook_Span_Attr;
+
+typedef struct Hook_Span {
+    const char*    type;
+    const char*    group;
+    Hook_Span_Attr attrs[HOOK_SPAN_MAX_ATTRS];
+    int            attr_count;
+    int            start;
+    int            end;
+} Hook_Span;
+
+typedef struct Hook_Reference {
+    unsigned int page;
+    unsigned int offset;
+} Hook_Reference;
+
+typedef enum {
+    HOOK_MEDIA_COLOR_BMP,
+    HOOK_MEDIA_COLOR_JPEG,
+    HOOK_MEDIA_WAVE,
+    HOOK_MEDIA_MPEG,
+} Hook_Media_Type;
+
+typedef struct Hook_Glyph {
+    Gaiji_Width  width;
+    unsigned int code;
+} Hook_Glyph;
+
+/* Graphics use the first two arguments as page and offset, waves all four as start and end positions, and MPEG movies as the file name. */
+typedef struct Hook_Media {
+    Hook_Media_Type type;
+    unsigned int    args[4];
+} Hook_Media;
+
+typedef struct Hook_Context {
+    int             flags;
+
+    Hook_Span*      spans;
+    int             span_count;
+    int             span_alloc;
+    int             event_count;
+    int*            events;
+    int             event_alloc;
+
+    Gaiji_Map*      gaiji_map;
+    const char**    gaiji;
+    int             gaiji_count;
+    int             gaiji_alloc;
+
+    Hook_Reference* references;
+    int             reference_count;
+    int             reference_alloc;
+
+    Hook_Media*     media;
+    int             media_count;
+    int             media_alloc;
+
+    Hook_Glyph*     glyphs;
+    int             glyph_count;
+    int             glyph_alloc;
+} Hook_Context;
+
 /*
  * Functions
  */
 
 void hooks_install(EB_Hookset* hookset, int flags);
+void hooks_context_reset(Hook_Context* context);
+void hooks_context_free(Hook_Context* context);
+char* hooks_resolve(Hook_Context* context, char text[]);
+char* hooks_strip(const Hook_Context* context, char text[]);
+const char* hooks_span_name(const char name[]);
 
 #endif /* HOOKS_H */
@@ -0,0 +1,129 @@
+/*
+ * Copyright (C) 2017  Alex Yatskov <alex@foosoft.net>
+ * Author: Alex Yatskov <alex@foosoft.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "intern.h"
+
+/*
+ * Local functions
+ */
+
+static uint64_t intern_hash(const char text[]) {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (const unsigned char* ptr = (const unsigned char*)text; *ptr != 0; ++ptr) {
+        hash ^= *ptr;
+        hash *= 0x100000001b3ULL;
+    }
+
+    return hash;
+}
+
+static void intern_pool_rehash(Intern_Pool* pool, int slot_count) {
+    free(pool->slots);
+    pool->slot_count = slot_count;
+    pool->slots = malloc(slot_count * sizeof(int));
+    memset(pool->slots, 0xff, slot_count * sizeof(int));
+
+    for (int i = 0; i < pool->count; ++i) {
+        int slot = pool->hashes[i] & (slot_count - 1);
+        while (pool->slots[slot] >= 0) {
+            slot = (slot + 1) & (slot_count - 1);
+        }
+
+        pool->slots[slot] = i;
+    }
+}
+
+/*
+ * Exported functions
+ */
+
+void intern_pool_init(Intern_Pool* pool) {
+    memset(pool, 0, sizeof(Intern_Pool));
+}
+
+void intern_pool_free(Intern_Pool* pool) {
+    for (int i = 0; i < pool->count; ++i) {
+        free(pool->strings[i]);
+    }
+
+    free(pool->strings);
+    free(pool->hashes);
+    free(pool->slots);
+    intern_pool_init(pool);
+}
+
+int intern_pool_add(Intern_Pool* pool, char** text) {
+    const uint64_t hash = intern_hash(*text);
+
+    /* Keep the table at most half full so probe runs stay short. */
+    if ((pool->count + 1) * 2 > pool->slot_count) {
+        intern_pool_rehash(pool, pool->slot_count == 0 ? 1024 : pool->slot_count * 2);
+    }
+
+    int slot = hash & (pool->slot_count - 1);
+    for (int index; (index = pool->slots[slot]) >= 0; slot = (slot + 1) & (pool->slot_count - 1)) {
+        if (pool->hashes[index] == hash && strcmp(pool->strings[index], *text) == 0) {
+            free(*text);
+            *text = pool->strings[index];
+            return index;
+        }
+    }
+
+    if (pool->count == pool->alloc) {
+        pool->alloc = pool->alloc == 0 ? 1024 : pool->alloc * 2;
+        pool->strings = realloc(pool->strings, pool->alloc * sizeof(char*));
+        pool->hashes = realloc(pool->hashes, pool->alloc * sizeof(uint64_t));
+    }
+
+    const int index = pool->count++;
+    pool->strings[index] = *text;
+    pool->hashes[index] = hash;
+    pool->slots[slot] = index;
+    return index;
+}
+
+void intern_pool_compact(Intern_Pool* pool, const int remap[], int count) {
+    char** strings = malloc((count > 0 ? count : 1) * sizeof(char*));
+    uint64_t* hashes = malloc((count > 0 ? count : 1) * sizeof(uint64_t));
+
+    for (int i = 0; i < pool->count; ++i) {
+        if (remap[i] < 0) {
+            free(pool->strings[i]);
+        }
+        else {
+            strings[remap[i]] = pool->strings[i];
+            hashes[remap[i]] = pool->hashes[i];
+        }
+    }
+
+    free(pool->strings);
+    free(pool->hashes);
+
+    pool->strings = strings;
+    pool->hashes = hashes;
+    pool->count = count;
+    pool->alloc = count;
+
+    if (pool->slot_count > 0) {
+        intern_pool_rehash(pool, pool->slot_count);
+    }
+}
@@ -0,0 +1,48 @@
+/*
+ * Copyright (C) 2017  Alex Yatskov <alex@foosoft.net>
+ * Author: Alex Yatskov <alex@foosoft.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef INTERN_H
+#define INTERN_H
+
+#include <stdint.h>
+
+/*
+ * Types
+ */
+
+typedef struct Intern_Pool {
+    char**    strings;
+    uint64_t* hashes;
+    int       count;
+    int       alloc;
+
+    int*      slots;
+    int       slot_count;
+} Intern_Pool;
+
+/*
+ * Functions
+ */
+
+void intern_pool_init(Intern_Pool* pool);
+void intern_pool_free(Intern_Pool* pool);
+int intern_pool_add(Intern_Pool* pool, char** text);
+void intern_pool_compact(Intern_Pool* pool, const int remap[], int count);
+
+#endif /* INTERN_H */
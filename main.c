@@ -17,10 +17,52 @@
  */
 
 #include <stdlib.h>
+#include <string.h>
 #include <getopt.h>
 
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#endif
+
 #include "util.h"
 #include "book.h"
+#include "cache.h"
+#include "parallel.h"
+#include "writer.h"
+
+/*
+ * Local functions
+ */
+
+/* Parses a list such as "24,48" into a mask with a bit per size, in the order fonts are stored in. */
+static int font_sizes_parse(const char list[], int* sizes) {
+    const int heights[] = {16, 24, 30, 48};
+
+    *sizes = 0;
+    for (const char* token = list;; ++token) {
+        char* end = NULL;
+        const long height = strtol(token, &end, 10);
+
+        int found = 0;
+        for (unsigned i = 0; i < ARRSIZE(heights); ++i) {
+            if (heights[i] == height) {
+                *sizes |= 1 << i;
+                found = 1;
+            }
+        }
+
+        if (!found || end == token || (*end != ',' && *end != 0)) {
+            return 0;
+        }
+
+        if (*end == 0) {
+            return 1;
+        }
+
+        token = end;
+    }
+}
 
 /*
  * Entry point
@@ -28,34 +70,189 @@
 
 int main(int argc, char *argv[]) {
     const struct option options[] = {
-        { "pretty",    no_argument, NULL, 'p' },
-        { "markup",    no_argument, NULL, 'm' },
-        { "positions", no_argument, NULL, 's' },
-        { "fonts",     no_argument, NULL, 'f' },
-        { "entries",   no_argument, NULL, 'e' },
-        { NULL,        0,           NULL,  0  },
+        { "pretty",        no_argument,       NULL, 'p' },
+        { "markup",        no_argument,       NULL, 'm' },
+        { "markup-spans",  no_argument,       NULL, 'M' },
+        { "positions",     no_argument,       NULL, 's' },
+        { "fonts",         no_argument,       NULL, 'f' },
+        { "entries",       no_argument,       NULL, 'e' },
+        { "compress",      required_argument, NULL, 'z' },
+        { "threads",       required_argument, NULL, 't' },
+        { "gaiji-map",     required_argument, NULL, 'g' },
+        { "intern",        no_argument,       NULL, 'i' },
+        { "headings-only", no_argument,       NULL, 'H' },
+        { "fetch",         required_argument, NULL, 'F' },
+        { "references",    no_argument,       NULL, 'r' },
+        { "stats",         no_argument,       NULL, 'S' },
+        { "trace",         required_argument, NULL, 'T' },
+        { "sort",          required_argument, NULL, 'o' },
+        { "media",         required_argument, NULL, 'x' },
+        { "normalize",     no_argument,       NULL, 'n' },
+        { "heading-key",   no_argument,       NULL, 'k' },
+        { "shard-output",  required_argument, NULL, 'O' },
+        { "shard-count",   required_argument, NULL, 'c' },
+        { "shard-by",      required_argument, NULL, 'B' },
+        { "part",          required_argument, NULL, 'P' },
+        { "merge",         no_argument,       NULL, 'R' },
+        { "slice-cache",   required_argument, NULL, 'C' },
+        { "hashes",        no_argument,       NULL, 'a' },
+        { "match-heading", required_argument, NULL, 'y' },
+        { "match-text",    required_argument, NULL, 'X' },
+        { "match-literal", no_argument,       NULL, 'l' },
+        { "fonts-used",    no_argument,       NULL, 'u' },
+        { "font-sizes",    required_argument, NULL, 'Z' },
+        { NULL,            0,                 NULL,  0  },
     };
 
     char* dict_path = NULL;
-    int flags = 0;
+    Book_Options book_options = {};
+    book_options.threads = parallel_cpu_count();
+    book_options.shard_count = 4;
+    Writer_Compress compress = WRITER_COMPRESS_NONE;
+    int stats = 0;
+    const char* trace_path = NULL;
+    int slice_cache = 0;
+    int merge = 0;
+    const char* match_heading = NULL;
+    const char* match_text = NULL;
+    int match_literal = 0;
 
     int c = 0;
-    while ((c = getopt_long(argc, argv, "fepmst", options, NULL)) != -1) {
+    while ((c = getopt_long(argc, argv, "afepiHklmMnRrsSuz:t:g:F:T:o:x:O:c:B:P:C:y:X:Z:", options, NULL)) != -1) {
         switch (c) {
             case 'p':
-                flags |= FLAG_PRETTY_PRINT;
+                book_options.flags |= FLAG_PRETTY_PRINT;
                 break;
             case 'm':
-                flags |= FLAG_HOOK_MARKUP;
+                book_options.flags |= FLAG_HOOK_MARKUP;
+                break;
+            case 'M':
+                book_options.flags |= FLAG_MARKUP_SPANS;
                 break;
             case 's':
-                flags |= FLAG_POSITIONS;
+                book_options.flags |= FLAG_POSITIONS;
                 break;
             case 'f':
-                flags |= FLAG_FONTS;
+                book_options.flags |= FLAG_FONTS;
                 break;
             case 'e':
-                flags |= FLAG_ENTRIES;
+                book_options.flags |= FLAG_ENTRIES;
+                break;
+            case 'z':
+                if (strcmp(optarg, "gzip") == 0) {
+                    compress = WRITER_COMPRESS_GZIP;
+                }
+                else if (strcmp(optarg, "none") != 0) {
+                    fprintf(stderr, "error: unsupported compression format (%s)\n", optarg);
+                    return 1;
+                }
+                break;
+            case 't':
+                book_options.threads = atoi(optarg);
+                if (book_options.threads < 1) {
+                    fprintf(stderr, "error: invalid thread count (%s)\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'g':
+                book_options.gaiji_map_path = optarg;
+                break;
+            case 'i':
+                book_options.flags |= FLAG_INTERN;
+                break;
+            case 'H':
+                book_options.flags |= FLAG_HEADINGS | FLAG_ENTRIES | FLAG_POSITIONS;
+                break;
+            case 'F':
+                book_options.fetch_path = optarg;
+                break;
+            case 'r':
+                book_options.flags |= FLAG_REFERENCES;
+                break;
+            case 'S':
+                stats = 1;
+                break;
+            case 'T':
+                trace_path = optarg;
+                break;
+            case 'o':
+                if (strcmp(optarg, "heading") == 0) {
+                    book_options.sort = BOOK_SORT_HEADING;
+                }
+                else if (strcmp(optarg, "none") != 0) {
+                    fprintf(stderr, "error: unsupported sort key (%s)\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'x':
+                book_options.flags |= FLAG_MEDIA;
+                book_options.media_path = optarg;
+                break;
+            case 'n':
+                book_options.flags |= FLAG_NORMALIZE;
+                break;
+            case 'k':
+                book_options.flags |= FLAG_HEADING_KEY;
+                break;
+            case 'O':
+                book_options.shard_prefix = optarg;
+                break;
+            case 'c':
+                book_options.shard_count = atoi(optarg);
+                if (book_options.shard_count < 1) {
+                    fprintf(stderr, "error: invalid shard count (%s)\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'B':
+                if (strcmp(optarg, "subbook") == 0) {
+                    book_options.shard_by = BOOK_SHARD_SUBBOOK;
+                }
+                else if (strcmp(optarg, "book") != 0) {
+                    fprintf(stderr, "error: unsupported shard grouping (%s)\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'P':
+                if (
+                    sscanf(optarg, "%d/%d", &book_options.part_index, &book_options.part_count) != 2 ||
+                    book_options.part_index < 0 ||
+                    book_options.part_index >= book_options.part_count
+                ) {
+                    fprintf(stderr, "error: invalid part (%s)\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'a':
+                book_options.flags |= FLAG_HASHES;
+                break;
+            case 'y':
+                match_heading = optarg;
+                break;
+            case 'X':
+                match_text = optarg;
+                break;
+            case 'l':
+                match_literal = 1;
+                break;
+            case 'u':
+                book_options.flags |= FLAG_FONTS | FLAG_FONTS_USED;
+                break;
+            case 'Z':
+                if (!font_sizes_parse(optarg, &book_options.font_sizes)) {
+                    fprintf(stderr, "error: invalid font sizes (%s)\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'R':
+                merge = 1;
+                break;
+            case 'C':
+                slice_cache = atoi(optarg);
+                if (slice_cache < 0 || (slice_cache == 0 && strcmp(optarg, "0") != 0)) {
+                    fprintf(stderr, "error: invalid slice cache size (%s)\n", optarg);
+                    return 1;
+                }
                 break;
             default:
                 return 1;
@@ -63,17 +260,102 @@ int main(int argc, char *argv[]) {
     }
 
     if (optind == argc) {
-        fprintf(stderr, "error: dictionary path was not provided\n");
+        fprintf(stderr, merge ? "error: part files were not provided\n" : "error: dictionary path was not provided\n");
         return 1;
     }
 
     dict_path = argv[optind];
 
+    if (book_options.fetch_path != NULL && (book_options.flags & FLAG_ENTRIES)) {
+        fprintf(stderr, "error: --fetch cannot be combined with --entries or --headings-only\n");
+        return 1;
+    }
+
+    if (book_options.part_count > 0 && (merge || book_options.shard_prefix != NULL || !(book_options.flags & FLAG_ENTRIES))) {
+        fprintf(stderr, "error: --part requires --entries or --headings-only, and cannot be combined with --shard-output or --merge\n");
+        return 1;
+    }
+
+    if ((book_options.flags & FLAG_HASHES) && !merge && !(book_options.flags & FLAG_ENTRIES)) {
+        fprintf(stderr, "error: --hashes requires --entries or --headings-only\n");
+        return 1;
+    }
+
+    if ((match_heading != NULL || match_text != NULL) && (merge || !(book_options.flags & FLAG_ENTRIES))) {
+        fprintf(stderr, "error: --match-heading and --match-text require --entries or --headings-only, and cannot be used with --merge\n");
+        return 1;
+    }
+
+    if ((book_options.flags & FLAG_FONTS_USED) && (merge || !(book_options.flags & FLAG_ENTRIES))) {
+        fprintf(stderr, "error: --fonts-used requires --entries or --headings-only, and cannot be used with --merge\n");
+        return 1;
+    }
+
+    if (book_options.shard_prefix != NULL && !merge && !(book_options.flags & FLAG_ENTRIES)) {
+        fprintf(stderr, "error: --shard-output requires --entries or --headings-only\n");
+        return 1;
+    }
+
+#ifdef _WIN32
+    if (compress != WRITER_COMPRESS_NONE || book_options.part_count > 0) {
+        _setmode(_fileno(stdout), _O_BINARY);
+    }
+#endif
+
+    if (slice_cache > 0 && !cache_init((size_t)slice_cache * 1024 * 1024)) {
+        fprintf(stderr, "error: the slice cache is not supported on this platform\n");
+        return 1;
+    }
+
+    if (match_heading != NULL && (book_options.match_heading = match_create(match_heading, match_literal)) == NULL) {
+        return 1;
+    }
+
+    if (match_text != NULL && (book_options.match_text = match_create(match_text, match_literal)) == NULL) {
+        match_destroy(book_options.match_heading);
+        return 1;
+    }
+
+    if (stats) {
+        book_options.stats = stats_create();
+    }
+
+    if (trace_path != NULL && (book_options.trace = trace_create(trace_path)) == NULL) {
+        stats_destroy(book_options.stats);
+        match_destroy(book_options.match_heading);
+        match_destroy(book_options.match_text);
+        return 1;
+    }
+
     Book* book = book_create();
-    const int success =
-        book_import(book, dict_path, flags) &&
-        book_export(stdout, book, flags);
+    Writer* writer = writer_create(stdout, compress, book_options.threads);
+    int success = merge ?
+        book_merge(book, argv + optind, argc - optind, &book_options) :
+        book_import(book, dict_path, &book_options);
+
+    if (book_options.part_count > 0) {
+        success = success && book_export_part(writer, book, &book_options);
+    }
+    else if (book_options.shard_prefix != NULL) {
+        success = success && book_export_shards(writer, book, &book_options, compress);
+    }
+    else {
+        success = success && book_export(writer, book, &book_options);
+    }
+
+    success = success && writer_finish(writer);
+    writer_destroy(writer);
     book_destroy(book);
+    cache_free();
+    match_destroy(book_options.match_heading);
+    match_destroy(book_options.match_text);
+
+    success = trace_destroy(book_options.trace) && success;
+
+    if (book_options.stats != NULL) {
+        stats_report(book_options.stats, stderr);
+        stats_destroy(book_options.stats);
+    }
 
     return success ? 0 : 1;
 }
@@ -0,0 +1,107 @@
+/*
+ * Copyright (C) 2017  Alex Yatskov <alex@foosoft.net>
+ * Author: Alex Yatskov <alex@foosoft.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <regex.h>
+#endif
+
+#include "match.h"
+
+/*
+ * Local types
+ */
+
+struct Match {
+    char*   literal;
+#ifndef _WIN32
+    regex_t regex;
+#endif
+};
+
+/*
+ * Exported functions
+ */
+
+/*
+ * Patterns are POSIX extended regular expressions, with ^ and $ matching at
+ * line breaks, unless literal is set. Either kind is matched against the
+ * UTF-8 bytes of the text.
+ */
+
+Match* match_create(const char pattern[], int literal) {
+    Match* match = calloc(1, sizeof(Match));
+    if (literal) {
+        match->literal = strdup(pattern);
+        return match;
+    }
+
+#ifdef _WIN32
+    fprintf(stderr, "error: regular expressions are not supported on this platform, use --match-literal\n");
+    free(match);
+    return NULL;
+#else
+    const int error = regcomp(&match->regex, pattern, REG_EXTENDED | REG_NOSUB | REG_NEWLINE);
+    if (error != 0) {
+        char message[256];
+        regerror(error, &match->regex, message, sizeof(message));
+        fprintf(stderr, "error: invalid pattern %s (%s)\n", pattern, message);
+        free(match);
+        return NULL;
+    }
+
+    return match;
+#endif
+}
+
+void match_destroy(Match* match) {
+    if (match == NULL) {
+        return;
+    }
+
+    if (match->literal != NULL) {
+        free(match->literal);
+    }
+#ifndef _WIN32
+    else {
+        regfree(&match->regex);
+    }
+#endif
+
+    free(match);
+}
+
+int match_test(const Match* match, const char text[]) {
+    if (text == NULL) {
+        text = "";
+    }
+
+    if (match->literal != NULL) {
+        return strstr(text, match->literal) != NULL;
+    }
+
+#ifdef _WIN32
+    return 0;
+#else
+    return regexec(&match->regex, text, 0, NULL, 0) == 0;
+#endif
+}
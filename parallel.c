@@ -0,0 +1,115 @@
+/*
+ * Copyright (C) 2017  Alex Yatskov <alex@foosoft.net>
+ * Author: Alex Yatskov <alex@foosoft.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <pthread.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+#include "parallel.h"
+
+/*
+ * Local types
+ */
+
+typedef struct Parallel_Job {
+    Parallel_Func   func;
+    void*           context;
+    int             count;
+    int             next;
+    pthread_mutex_t mutex;
+} Parallel_Job;
+
+/*
+ * Local functions
+ */
+
+static void* parallel_worker(void* data) {
+    Parallel_Job* job = data;
+
+    for (;;) {
+        pthread_mutex_lock(&job->mutex);
+        const int index = job->next < job->count ? job->next++ : -1;
+        pthread_mutex_unlock(&job->mutex);
+
+        if (index < 0) {
+            break;
+        }
+
+        job->func(job->context, index);
+    }
+
+    return NULL;
+}
+
+/*
+ * Exported functions
+ */
+
+void parallel_for(int count, int threads, Parallel_Func func, void* context) {
+    if (threads > count) {
+        threads = count;
+    }
+
+    if (threads <= 1) {
+        for (int i = 0; i < count; ++i) {
+            func(context, i);
+        }
+
+        return;
+    }
+
+    Parallel_Job job = {};
+    job.func = func;
+    job.context = context;
+    job.count = count;
+    pthread_mutex_init(&job.mutex, NULL);
+
+    /* The calling thread works through the queue alongside the workers. */
+    pthread_t* workers = malloc((threads - 1) * sizeof(pthread_t));
+    int worker_count = 0;
+    for (int i = 0; i < threads - 1; ++i) {
+        if (pthread_create(workers + worker_count, NULL, parallel_worker, &job) == 0) {
+            ++worker_count;
+        }
+    }
+
+    parallel_worker(&job);
+
+    for (int i = 0; i < worker_count; ++i) {
+        pthread_join(workers[i], NULL);
+    }
+
+    free(workers);
+    pthread_mutex_destroy(&job.mutex);
+}
+
+int parallel_cpu_count() {
+#ifdef _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    const int count = info.dwNumberOfProcessors;
+#else
+    const int count = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+    return count > 0 ? count : 1;
+}
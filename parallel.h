@@ -0,0 +1,36 @@
+/*
+ * Copyright (C) 2017  Alex Yatskov <alex@foosoft.net>
+ * Author: Alex Yatskov <alex@foosoft.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+/*
+ * Types
+ */
+
+typedef void (*Parallel_Func)(void* context, int index);
+
+/*
+ * Functions
+ */
+
+void parallel_for(int count, int threads, Parallel_Func func, void* context);
+int parallel_cpu_count();
+
+#endif /* PARALLEL_H */
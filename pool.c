@@ -0,0 +1,114 @@
+/*
+ * Copyright (C) 2017  Alex Yatskov <alex@foosoft.net>
+ * Author: Alex Yatskov <alex@foosoft.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "pool.h"
+
+/*
+ * Macros
+ */
+
+#define POOL_ALIGN 16
+#define POOL_ALIGN_UP(size) (((size) + POOL_ALIGN - 1) & ~(size_t)(POOL_ALIGN - 1))
+#define POOL_BLOCK_SIZE (64 * 1024)
+#define POOL_HEADER_SIZE POOL_ALIGN_UP(sizeof(Pool_Block))
+
+/*
+ * Local types
+ */
+
+struct Pool_Block {
+    Pool_Block* next;
+    size_t      size;
+};
+
+/*
+ * Exported functions
+ */
+
+void pool_init(Pool* pool) {
+    memset(pool, 0, sizeof(Pool));
+}
+
+void pool_free(Pool* pool) {
+    while (pool->blocks != NULL) {
+        Pool_Block* next = pool->blocks->next;
+        free(pool->blocks);
+        pool->blocks = next;
+    }
+
+    pool_init(pool);
+}
+
+/* Releases every allocation but keeps one standard block for reuse; the allocation count is kept. */
+void pool_reset(Pool* pool) {
+    Pool_Block* kept = NULL;
+    while (pool->blocks != NULL) {
+        Pool_Block* next = pool->blocks->next;
+        if (kept == NULL && pool->blocks->size == POOL_BLOCK_SIZE) {
+            kept = pool->blocks;
+            kept->next = NULL;
+        }
+        else {
+            free(pool->blocks);
+        }
+
+        pool->blocks = next;
+    }
+
+    pool->blocks = kept;
+    pool->used = 0;
+}
+
+void* pool_alloc(Pool* pool, size_t size) {
+    size = POOL_ALIGN_UP(size > 0 ? size : 1);
+    ++pool->allocations;
+
+    Pool_Block* block = pool->blocks;
+    if (block == NULL || pool->used + size > block->size) {
+        /* Requests too large to share a block get one of their own behind the current one. */
+        if (block != NULL && size > POOL_BLOCK_SIZE / 4) {
+            Pool_Block* large = malloc(POOL_HEADER_SIZE + size);
+            if (large == NULL) {
+                return NULL;
+            }
+
+            large->size = size;
+            large->next = block->next;
+            block->next = large;
+            return (char*)large + POOL_HEADER_SIZE;
+        }
+
+        const size_t block_size = size > POOL_BLOCK_SIZE ? size : POOL_BLOCK_SIZE;
+        if ((block = malloc(POOL_HEADER_SIZE + block_size)) == NULL) {
+            return NULL;
+        }
+
+        block->size = block_size;
+        block->next = pool->blocks;
+        pool->blocks = block;
+        pool->used = 0;
+    }
+
+    void* data = (char*)block + POOL_HEADER_SIZE + pool->used;
+    pool->used += size;
+    return data;
+}
@@ -0,0 +1,46 @@
+/*
+ * Copyright (C) 2017  Alex Yatskov <alex@foosoft.net>
+ * Author: Alex Yatskov <alex@foosoft.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef POOL_H
+#define POOL_H
+
+#include <stddef.h>
+
+/*
+ * Types
+ */
+
+typedef struct Pool_Block Pool_Block;
+
+typedef struct Pool {
+    Pool_Block* blocks;
+    size_t      used;
+    long long   allocations;
+} Pool;
+
+/*
+ * Functions
+ */
+
+void pool_init(Pool* pool);
+void pool_free(Pool* pool);
+void pool_reset(Pool* pool);
+void* pool_alloc(Pool* pool, size_t size);
+
+#endif /* POOL_H */
@@ -0,0 +1,230 @@
+/*
+ * Copyright (C) 2017  Alex Yatskov <alex@foosoft.net>
+ * Author: Alex Yatskov <alex@foosoft.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
+
+#include "stats.h"
+
+#include "jansson/include/jansson.h"
+
+/*
+ * Local types
+ */
+
+typedef struct Stats_Scope {
+    Stats_Clock phases[STATS_PHASE_COUNT];
+    long long   counters[STATS_COUNTER_COUNT];
+} Stats_Scope;
+
+struct Stats {
+    Stats_Clock  start;
+    Stats_Scope* scopes;
+    int          scope_count;
+    int          scope_current;
+};
+
+/*
+ * Local data
+ */
+
+static const char* s_phase_names[STATS_PHASE_COUNT] = {
+    "bind",
+    "hits",
+    "read",
+    "convert",
+    "undupe",
+    "sort",
+    "encode",
+    "write",
+};
+
+static const char* s_counter_names[STATS_COUNTER_COUNT] = {
+    "hits",
+    "duplicates",
+    "unmatched",
+    "entries",
+    "glyphs",
+    "media",
+    "bytesRead",
+    "bytesEmitted",
+    "jsonAllocations",
+    "sliceHits",
+    "sliceMisses",
+};
+
+/*
+ * Local functions
+ */
+
+static double stats_seconds(clockid_t clock_id) {
+    struct timespec time;
+    if (clock_gettime(clock_id, &time) != 0) {
+        return 0.0;
+    }
+
+    return time.tv_sec + time.tv_nsec / 1e9;
+}
+
+static Stats_Clock stats_now() {
+    Stats_Clock clock;
+    clock.wall = stats_seconds(CLOCK_MONOTONIC);
+    clock.cpu = stats_seconds(CLOCK_PROCESS_CPUTIME_ID);
+    return clock;
+}
+
+static long long stats_peak_rss() {
+#ifdef _WIN32
+    return 0;
+#else
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) {
+        return 0;
+    }
+#ifdef __APPLE__
+    return usage.ru_maxrss;
+#else
+    return usage.ru_maxrss * 1024LL;
+#endif
+#endif
+}
+
+static json_t* stats_scope_encode(const Stats_Scope* scope) {
+    json_t* scope_json = json_object();
+
+    json_t* phase_json = json_object();
+    for (int i = 0; i < STATS_PHASE_COUNT; ++i) {
+        json_t* clock_json = json_object();
+        json_object_set_new(clock_json, "wall", json_real(scope->phases[i].wall));
+        json_object_set_new(clock_json, "cpu", json_real(scope->phases[i].cpu));
+        json_object_set_new(phase_json, s_phase_names[i], clock_json);
+    }
+
+    json_object_set_new(scope_json, "phases", phase_json);
+
+    json_t* counter_json = json_object();
+    for (int i = 0; i < STATS_COUNTER_COUNT; ++i) {
+        json_object_set_new(counter_json, s_counter_names[i], json_integer(scope->counters[i]));
+    }
+
+    json_object_set_new(scope_json, "counters", counter_json);
+
+    const double read_time = scope->phases[STATS_PHASE_READ].wall;
+    const double emit_time = scope->phases[STATS_PHASE_ENCODE].wall + scope->phases[STATS_PHASE_WRITE].wall;
+
+    json_t* throughput_json = json_object();
+    json_object_set_new(throughput_json, "readBytesPerSecond", json_real(read_time > 0.0 ? scope->counters[STATS_COUNTER_BYTES_READ] / read_time : 0.0));
+    json_object_set_new(throughput_json, "emitBytesPerSecond", json_real(emit_time > 0.0 ? scope->counters[STATS_COUNTER_BYTES_EMITTED] / emit_time : 0.0));
+    json_object_set_new(scope_json, "throughput", throughput_json);
+
+    return scope_json;
+}
+
+/*
+ * Exported functions
+ */
+
+Stats* stats_create() {
+    Stats* stats = calloc(1, sizeof(Stats));
+    stats->start = stats_now();
+    stats->scope_count = 1;
+    stats->scopes = calloc(stats->scope_count, sizeof(Stats_Scope));
+    return stats;
+}
+
+void stats_destroy(Stats* stats) {
+    if (stats != NULL) {
+        free(stats->scopes);
+        free(stats);
+    }
+}
+
+/*
+ * Scope zero holds book level figures; subbook n is recorded in scope n + 1.
+ */
+
+void stats_select(Stats* stats, int subbook) {
+    if (stats == NULL) {
+        return;
+    }
+
+    const int scope = subbook + 1;
+    if (scope >= stats->scope_count) {
+        stats->scopes = realloc(stats->scopes, (scope + 1) * sizeof(Stats_Scope));
+        memset(stats->scopes + stats->scope_count, 0, (scope + 1 - stats->scope_count) * sizeof(Stats_Scope));
+        stats->scope_count = scope + 1;
+    }
+
+    stats->scope_current = scope;
+}
+
+Stats_Clock stats_begin(const Stats* stats) {
+    if (stats == NULL) {
+        const Stats_Clock clock = {};
+        return clock;
+    }
+
+    return stats_now();
+}
+
+void stats_end(Stats* stats, Stats_Phase phase, const Stats_Clock* clock) {
+    if (stats == NULL) {
+        return;
+    }
+
+    const Stats_Clock now = stats_now();
+    Stats_Clock* total = stats->scopes[stats->scope_current].phases + phase;
+    total->wall += now.wall - clock->wall;
+    total->cpu += now.cpu - clock->cpu;
+}
+
+void stats_count(Stats* stats, Stats_Counter counter, long long value) {
+    if (stats != NULL) {
+        stats->scopes[stats->scope_current].counters[counter] += value;
+    }
+}
+
+void stats_report(const Stats* stats, FILE* fp) {
+    const Stats_Clock now = stats_now();
+
+    json_t* stats_json = json_object();
+    json_object_set_new(stats_json, "wall", json_real(now.wall - stats->start.wall));
+    json_object_set_new(stats_json, "cpu", json_real(now.cpu - stats->start.cpu));
+    json_object_set_new(stats_json, "peakRss", json_integer(stats_peak_rss()));
+    json_object_set_new(stats_json, "book", stats_scope_encode(stats->scopes));
+
+    json_t* subbook_json_array = json_array();
+    for (int i = 1; i < stats->scope_count; ++i) {
+        json_array_append_new(subbook_json_array, stats_scope_encode(stats->scopes + i));
+    }
+
+    json_object_set_new(stats_json, "subbooks", subbook_json_array);
+
+    char* output = json_dumps(stats_json, JSON_COMPACT);
+    if (output != NULL) {
+        fprintf(fp, "%s\n", output);
+    }
+
+    free(output);
+    json_decref(stats_json);
+}
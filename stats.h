@@ -0,0 +1,75 @@
+/*
+ * Copyright (C) 2017  Alex Yatskov <alex@foosoft.net>
+ * Author: Alex Yatskov <alex@foosoft.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdio.h>
+
+/*
+ * Types
+ */
+
+typedef enum {
+    STATS_PHASE_BIND,
+    STATS_PHASE_HITS,
+    STATS_PHASE_READ,
+    STATS_PHASE_CONVERT,
+    STATS_PHASE_UNDUPE,
+    STATS_PHASE_SORT,
+    STATS_PHASE_ENCODE,
+    STATS_PHASE_WRITE,
+    STATS_PHASE_COUNT,
+} Stats_Phase;
+
+typedef enum {
+    STATS_COUNTER_HITS,
+    STATS_COUNTER_DUPLICATES,
+    STATS_COUNTER_UNMATCHED,
+    STATS_COUNTER_ENTRIES,
+    STATS_COUNTER_GLYPHS,
+    STATS_COUNTER_MEDIA,
+    STATS_COUNTER_BYTES_READ,
+    STATS_COUNTER_BYTES_EMITTED,
+    STATS_COUNTER_JSON_ALLOCATIONS,
+    STATS_COUNTER_SLICE_HITS,
+    STATS_COUNTER_SLICE_MISSES,
+    STATS_COUNTER_COUNT,
+} Stats_Counter;
+
+typedef struct Stats_Clock {
+    double wall;
+    double cpu;
+} Stats_Clock;
+
+typedef struct Stats Stats;
+
+/*
+ * Functions
+ */
+
+Stats* stats_create();
+void stats_destroy(Stats* stats);
+void stats_select(Stats* stats, int subbook);
+Stats_Clock stats_begin(const Stats* stats);
+void stats_end(Stats* stats, Stats_Phase phase, const Stats_Clock* clock);
+void stats_count(Stats* stats, Stats_Counter counter, long long value);
+void stats_report(const Stats* stats, FILE* fp);
+
+#endif /* STATS_H */
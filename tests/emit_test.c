@@ -0,0 +1,223 @@
+/*
+ * Copyright (C) 2017  Alex Yatskov <alex@foosoft.net>
+ * Author: Alex Yatskov <alex@foosoft.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "buffer.h"
+#include "emit.h"
+
+#include "jansson/include/jansson.h"
+
+/*
+ * Cross-checks the emit kernels against jansson, which they stand in for
+ * when exporting: every string must be accepted or rejected as UTF-8 the same
+ * way, and accepted strings must escape to the same bytes. Each check runs on
+ * both the SIMD and the scalar paths.
+ */
+
+/*
+ * Macros
+ */
+
+#define EMIT_TEST_RANDOM_COUNT 200000
+#define EMIT_TEST_RANDOM_SIZE 96
+#define EMIT_TEST_PADDING 40
+
+/*
+ * Local types
+ */
+
+typedef struct Emit_Test {
+    Buffer      buffer;
+    const char* path;
+    int         failures;
+} Emit_Test;
+
+/*
+ * Local data
+ */
+
+static const char* s_samples[] = {
+    "",
+    "plain ascii",
+    "\"quoted\" \\ back\\slash\b\f\n\r\t\x01\x1f\x7f",
+    "\xe3\x81\x82\xe3\x81\x84\xe3\x81\x86 \xe6\xbc\xa2\xe5\xad\x97",
+    "\xf0\x9f\x98\x80\xef\xbf\xbf\xf4\x8f\xbf\xbf",
+    "\xc2\x80\xdf\xbf\xe0\xa0\x80\xed\x9f\xbf\xee\x80\x80",
+    "\xc0\xaf",
+    "\xc1\xbf",
+    "\xe0\x80\xaf",
+    "\xe0\x9f\xbf",
+    "\xed\xa0\x80",
+    "\xed\xbf\xbf",
+    "\xf0\x8f\xbf\xbf",
+    "\xf4\x90\x80\x80",
+    "\xf5\x80\x80\x80",
+    "\xf8\x88\x80\x80\x80",
+    "truncated \xe3\x81",
+    "truncated \xf0\x9f\x98",
+    "stray \x80 continuation",
+    "\xff",
+    "\xfe\xfe\xff\xff",
+};
+
+/* Pieces that random strings are built from, weighted towards what entries hold. */
+static const char* s_pieces[] = {
+    "a", "b", "z", " ", "0", "~", "\"", "\\", "\n", "\t", "\x01", "\x1f", "\x7f",
+    "\xc2\xa9", "\xdf\xbf", "\xe3\x81\x82", "\xe6\xbc\xa2", "\xef\xbc\x81", "\xf0\x9f\x98\x80", "\xf4\x8f\xbf\xbf",
+    "\x80", "\xbf", "\xc0", "\xc1\x81", "\xe0\x80", "\xed\xa0\x80", "\xf4\x90", "\xf5", "\xff",
+};
+
+/*
+ * Local functions
+ */
+
+static unsigned emit_test_random(unsigned* seed) {
+    *seed = *seed * 1103515245 + 12345;
+    return *seed >> 8;
+}
+
+static void emit_test_check(Emit_Test* test, const char text[], size_t size) {
+    json_t* string_json = json_string(text);
+    if ((string_json != NULL) != emit_utf8_check(text, size)) {
+        fprintf(stderr, "error: %s path: UTF-8 validation differs from jansson for \"", test->path);
+        for (size_t i = 0; i < size; ++i) {
+            fprintf(stderr, "\\x%02x", (unsigned char)text[i]);
+        }
+        fprintf(stderr, "\"\n");
+        ++test->failures;
+    }
+
+    if (string_json == NULL) {
+        return;
+    }
+
+    char* expected = json_dumps(string_json, JSON_ENCODE_ANY);
+
+    buffer_clear(&test->buffer);
+    emit_string(&test->buffer, text, size);
+
+    if (expected == NULL || test->buffer.size != strlen(expected) || memcmp(test->buffer.data, expected, test->buffer.size) != 0) {
+        fprintf(stderr, "error: %s path: escaping differs from jansson for %s\n", test->path, expected);
+        ++test->failures;
+    }
+
+    free(expected);
+    json_decref(string_json);
+}
+
+/* Checks text on its own and behind every amount of padding, so it lands at each offset of a SIMD block. */
+static void emit_test_padded(Emit_Test* test, const char text[]) {
+    const size_t size = strlen(text);
+    char* padded = malloc(EMIT_TEST_PADDING + size + EMIT_TEST_PADDING + 1);
+
+    for (int padding = 0; padding <= EMIT_TEST_PADDING; ++padding) {
+        memset(padded, 'x', padding);
+        memcpy(padded + padding, text, size);
+        memset(padded + padding + size, 'y', EMIT_TEST_PADDING - padding);
+        padded[size + EMIT_TEST_PADDING] = 0;
+        emit_test_check(test, padded, size + EMIT_TEST_PADDING);
+
+        padded[padding + size] = 0;
+        emit_test_check(test, padded + padding, size);
+        emit_test_check(test, padded, padding + size);
+    }
+
+    free(padded);
+}
+
+/* Every sequence of one or two bytes, then a slice of three byte sequences around the lead bytes that matter. */
+static void emit_test_sequences(Emit_Test* test) {
+    char text[4] = {};
+    for (int i = 1; i < 256; ++i) {
+        text[0] = i;
+        text[1] = 0;
+        emit_test_check(test, text, 1);
+
+        for (int j = 1; j < 256; ++j) {
+            text[1] = j;
+            emit_test_check(test, text, 2);
+        }
+    }
+
+    const int leads[] = {0xc2, 0xe0, 0xe1, 0xed, 0xee, 0xef, 0xf0, 0xf4, 0xf5};
+    for (unsigned i = 0; i < sizeof(leads) / sizeof(leads[0]); ++i) {
+        text[0] = leads[i];
+        for (int j = 0x70; j < 0xd0; ++j) {
+            text[1] = j;
+            for (int k = 0x70; k < 0xd0; ++k) {
+                text[2] = k;
+                emit_test_check(test, text, 3);
+            }
+        }
+    }
+}
+
+static void emit_test_random_strings(Emit_Test* test) {
+    char text[EMIT_TEST_RANDOM_SIZE + 8];
+    unsigned seed = 1;
+
+    for (int i = 0; i < EMIT_TEST_RANDOM_COUNT; ++i) {
+        const size_t limit = emit_test_random(&seed) % EMIT_TEST_RANDOM_SIZE;
+        const int clean = emit_test_random(&seed) % 4 == 0;
+
+        size_t size = 0;
+        while (size < limit) {
+            /* Most strings stay in the first half of the pieces, which are all valid. */
+            const unsigned count = sizeof(s_pieces) / sizeof(s_pieces[0]);
+            const char* piece = s_pieces[emit_test_random(&seed) % (clean ? 20 : count)];
+            const size_t piece_size = strlen(piece);
+            memcpy(text + size, piece, piece_size);
+            size += piece_size;
+        }
+
+        text[size] = 0;
+        emit_test_check(test, text, size);
+    }
+}
+
+static int emit_test_run(const char path[], int scalar) {
+    Emit_Test test = {};
+    test.path = path;
+    emit_force_scalar(scalar);
+
+    for (unsigned i = 0; i < sizeof(s_samples) / sizeof(s_samples[0]); ++i) {
+        emit_test_padded(&test, s_samples[i]);
+    }
+
+    emit_test_sequences(&test);
+    emit_test_random_strings(&test);
+
+    buffer_free(&test.buffer);
+    emit_force_scalar(0);
+
+    fprintf(stderr, "%s path: %d failures\n", path, test.failures);
+    return test.failures == 0;
+}
+
+/*
+ * Entry point
+ */
+
+int main() {
+    const int simd_success = emit_test_run("simd", 0);
+    const int scalar_success = emit_test_run("scalar", 1);
+    return simd_success && scalar_success ? 0 : 1;
+}
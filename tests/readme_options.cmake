@@ -0,0 +1,40 @@
+# Checks that every long option in main.c is listed in the README usage
+# section with its short form, and that the short form is in the option string.
+#
+# cmake -DSOURCE_DIR=<repo> -P readme_options.cmake
+
+file(READ ${SOURCE_DIR}/main.c main_source)
+file(READ ${SOURCE_DIR}/README.md readme)
+
+string(REGEX MATCH "getopt_long\\(argc, argv, \"([^\"]*)\"" optstring_match "${main_source}")
+set(optstring "${CMAKE_MATCH_1}")
+
+string(REGEX MATCHALL "{ \"[a-z-]+\", +[a-z_]+, +NULL, '.' }" option_entries "${main_source}")
+list(LENGTH option_entries option_count)
+if (option_count EQUAL 0)
+    message(FATAL_ERROR "no options found in main.c")
+endif ()
+
+set(failed 0)
+foreach (entry ${option_entries})
+    string(REGEX MATCH "{ \"([a-z-]+)\", +[a-z_]+, +NULL, '(.)' }" parts "${entry}")
+    set(name "${CMAKE_MATCH_1}")
+    set(letter "${CMAKE_MATCH_2}")
+
+    # Entries may show an argument, as in `--compress gzip` (`-z`).
+    string(REGEX MATCH "\\*   `--${name}[^`]*` \\(`-${letter}`\\)" readme_entry "${readme}")
+    if (NOT readme_entry)
+        message(SEND_ERROR "--${name} (-${letter}) is not listed in README.md")
+        set(failed 1)
+    endif ()
+
+    string(FIND "${optstring}" "${letter}" optstring_index)
+    if (optstring_index EQUAL -1)
+        message(SEND_ERROR "-${letter} (--${name}) is missing from the getopt_long option string")
+        set(failed 1)
+    endif ()
+endforeach ()
+
+if (failed)
+    message(FATAL_ERROR "README.md and main.c disagree on the options")
+endif ()
@@ -0,0 +1,133 @@
+/*
+ * Copyright (C) 2017  Alex Yatskov <alex@foosoft.net>
+ * Author: Alex Yatskov <alex@foosoft.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "trace.h"
+
+/*
+ * Local types
+ */
+
+struct Trace {
+    FILE*           fp;
+    pthread_mutex_t mutex;
+    double          start;
+    int             event_count;
+    int             thread_count;
+};
+
+/*
+ * Local data
+ */
+
+static __thread int s_thread_id = -1;
+
+/*
+ * Local functions
+ */
+
+static double trace_now() {
+    struct timespec time;
+    if (clock_gettime(CLOCK_MONOTONIC, &time) != 0) {
+        return 0.0;
+    }
+
+    return time.tv_sec * 1e6 + time.tv_nsec / 1e3;
+}
+
+static void trace_event(Trace* trace, char phase, const char name[], const char arg_name[], long long arg_value) {
+    const double timestamp = trace_now() - trace->start;
+
+    pthread_mutex_lock(&trace->mutex);
+
+    if (s_thread_id < 0) {
+        s_thread_id = trace->thread_count++;
+    }
+
+    fprintf(
+        trace->fp,
+        "%s\n{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%.3f,\"pid\":1,\"tid\":%d",
+        trace->event_count++ > 0 ? "," : "",
+        name,
+        phase,
+        timestamp,
+        s_thread_id
+    );
+
+    if (arg_name != NULL) {
+        fprintf(trace->fp, ",\"args\":{\"%s\":%lld}", arg_name, arg_value);
+    }
+
+    fputc('}', trace->fp);
+
+    pthread_mutex_unlock(&trace->mutex);
+}
+
+/*
+ * Exported functions
+ */
+
+Trace* trace_create(const char path[]) {
+    FILE* fp = fopen(path, "wb");
+    if (fp == NULL) {
+        fprintf(stderr, "error: failed to open trace file %s\n", path);
+        return NULL;
+    }
+
+    Trace* trace = calloc(1, sizeof(Trace));
+    trace->fp = fp;
+    trace->start = trace_now();
+    pthread_mutex_init(&trace->mutex, NULL);
+
+    fputs("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[", trace->fp);
+    return trace;
+}
+
+int trace_destroy(Trace* trace) {
+    if (trace == NULL) {
+        return 1;
+    }
+
+    fputs("\n]}\n", trace->fp);
+
+    const int success = !ferror(trace->fp) && fclose(trace->fp) == 0;
+    if (!success) {
+        fprintf(stderr, "error: failed to write trace file\n");
+    }
+
+    pthread_mutex_destroy(&trace->mutex);
+    free(trace);
+    return success;
+}
+
+void trace_begin(Trace* trace, const char name[], const char arg_name[], long long arg_value) {
+    if (trace != NULL) {
+        trace_event(trace, 'B', name, arg_name, arg_value);
+    }
+}
+
+void trace_end(Trace* trace, const char name[], const char arg_name[], long long arg_value) {
+    if (trace != NULL) {
+        trace_event(trace, 'E', name, arg_name, arg_value);
+    }
+}
@@ -0,0 +1,38 @@
+/*
+ * Copyright (C) 2017  Alex Yatskov <alex@foosoft.net>
+ * Author: Alex Yatskov <alex@foosoft.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef TRACE_H
+#define TRACE_H
+
+/*
+ * Types
+ */
+
+typedef struct Trace Trace;
+
+/*
+ * Functions
+ */
+
+Trace* trace_create(const char path[]);
+int trace_destroy(Trace* trace);
+void trace_begin(Trace* trace, const char name[], const char arg_name[], long long arg_value);
+void trace_end(Trace* trace, const char name[], const char arg_name[], long long arg_value);
+
+#endif /* TRACE_H */
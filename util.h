@@ -31,6 +31,15 @@ enum {
     FLAG_POSITIONS    = 1 << 2,
     FLAG_FONTS        = 1 << 3,
     FLAG_ENTRIES      = 1 << 4,
+    FLAG_MARKUP_SPANS = 1 << 5,
+    FLAG_INTERN       = 1 << 6,
+    FLAG_HEADINGS     = 1 << 7,
+    FLAG_REFERENCES   = 1 << 8,
+    FLAG_MEDIA        = 1 << 9,
+    FLAG_NORMALIZE    = 1 << 10,
+    FLAG_HEADING_KEY  = 1 << 11,
+    FLAG_HASHES       = 1 << 12,
+    FLAG_FONTS_USED   = 1 << 13,
 };
 
 #endif /* UTIL_H */
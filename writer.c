@@ -0,0 +1,255 @@
+/*
+ * Copyright (C) 2017  Alex Yatskov <alex@foosoft.net>
+ * Author: Alex Yatskov <alex@foosoft.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+
+#include "writer.h"
+#include "parallel.h"
+
+/*
+ * Macros
+ */
+
+#define WRITER_BLOCK_SIZE (128 * 1024)
+
+/*
+ * Local types
+ */
+
+typedef struct Writer_Block {
+    char*          input;
+    size_t         input_size;
+    unsigned char* output;
+    size_t         output_size;
+    size_t         output_alloc;
+    uLong          crc;
+    int            error;
+} Writer_Block;
+
+struct Writer {
+    FILE*           fp;
+    Writer_Compress compress;
+
+    Writer_Block*   blocks;
+    int             block_count;
+    int             block_alloc;
+
+    uLong           crc;
+    uLong           size;
+    int             header_written;
+    int             error;
+};
+
+/*
+ * Local data
+ */
+
+static const unsigned char s_gzip_header[] = {
+    0x1f, 0x8b,             /* magic */
+    0x08,                   /* deflate */
+    0x00,                   /* flags */
+    0x00, 0x00, 0x00, 0x00, /* modification time */
+    0x00,                   /* extra flags */
+    0xff,                   /* unknown operating system */
+};
+
+/* Empty final block with fixed Huffman codes; terminates the deflate stream. */
+static const unsigned char s_deflate_trailer[] = { 0x03, 0x00 };
+
+/*
+ * Local functions
+ */
+
+static void writer_block_compress(void* context, int index) {
+    Writer_Block* block = (Writer_Block*)context + index;
+    block->crc = crc32(crc32(0, NULL, 0), (const Bytef*)block->input, block->input_size);
+
+    z_stream stream = {};
+    if (deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        block->error = 1;
+        return;
+    }
+
+    /* Leave room for the empty stored block that a sync flush appends. */
+    const size_t output_bound = deflateBound(&stream, block->input_size) + 16;
+    if (block->output_alloc < output_bound) {
+        free(block->output);
+        block->output_alloc = output_bound;
+        block->output = malloc(block->output_alloc);
+    }
+
+    stream.next_in = (Bytef*)block->input;
+    stream.avail_in = block->input_size;
+    stream.next_out = block->output;
+    stream.avail_out = block->output_alloc;
+
+    /*
+     * Each block is an independent deflate sequence which ends on a byte
+     * boundary, so compressed blocks can be concatenated into a single
+     * stream in order, the same way pigz does it.
+     */
+
+    block->error = deflate(&stream, Z_SYNC_FLUSH) != Z_OK || stream.avail_in != 0;
+    block->output_size = block->output_alloc - stream.avail_out;
+
+    deflateEnd(&stream);
+}
+
+static int writer_put(Writer* writer, const void* data, size_t size) {
+    if (writer->error) {
+        return 0;
+    }
+
+    if (size > 0 && fwrite(data, 1, size, writer->fp) != size) {
+        fprintf(stderr, "error: failed to write output\n");
+        writer->error = 1;
+        return 0;
+    }
+
+    return 1;
+}
+
+static int writer_flush_blocks(Writer* writer) {
+    const int block_count = writer->block_count;
+    if (block_count == 0) {
+        return !writer->error;
+    }
+
+    parallel_for(block_count, writer->block_alloc, writer_block_compress, writer->blocks);
+
+    if (!writer->header_written) {
+        writer->header_written = writer_put(writer, s_gzip_header, sizeof(s_gzip_header));
+    }
+
+    for (int i = 0; i < block_count; ++i) {
+        Writer_Block* block = writer->blocks + i;
+        if (block->error) {
+            fprintf(stderr, "error: failed to compress output\n");
+            writer->error = 1;
+            break;
+        }
+
+        writer_put(writer, block->output, block->output_size);
+        writer->crc = crc32_combine(writer->crc, block->crc, block->input_size);
+        writer->size += block->input_size;
+        block->input_size = 0;
+    }
+
+    writer->block_count = 0;
+    return !writer->error;
+}
+
+/*
+ * Exported functions
+ */
+
+Writer* writer_create(FILE* fp, Writer_Compress compress, int threads) {
+    Writer* writer = calloc(1, sizeof(Writer));
+    writer->fp = fp;
+    writer->compress = compress;
+    writer->crc = crc32(0, NULL, 0);
+
+    if (compress != WRITER_COMPRESS_NONE) {
+        writer->block_alloc = threads > 0 ? threads : 1;
+        writer->blocks = calloc(writer->block_alloc, sizeof(Writer_Block));
+        for (int i = 0; i < writer->block_alloc; ++i) {
+            writer->blocks[i].input = malloc(WRITER_BLOCK_SIZE);
+        }
+    }
+
+    return writer;
+}
+
+void writer_destroy(Writer* writer) {
+    for (int i = 0; i < writer->block_alloc; ++i) {
+        free(writer->blocks[i].input);
+        free(writer->blocks[i].output);
+    }
+
+    free(writer->blocks);
+    free(writer);
+}
+
+int writer_write(Writer* writer, const char data[], size_t size) {
+    if (writer->compress == WRITER_COMPRESS_NONE) {
+        return writer_put(writer, data, size);
+    }
+
+    while (size > 0) {
+        if (writer->block_count == 0 || writer->blocks[writer->block_count - 1].input_size == WRITER_BLOCK_SIZE) {
+            if (writer->block_count == writer->block_alloc && !writer_flush_blocks(writer)) {
+                return 0;
+            }
+
+            ++writer->block_count;
+        }
+
+        Writer_Block* block = writer->blocks + writer->block_count - 1;
+        size_t chunk_size = WRITER_BLOCK_SIZE - block->input_size;
+        if (chunk_size > size) {
+            chunk_size = size;
+        }
+
+        memcpy(block->input + block->input_size, data, chunk_size);
+        block->input_size += chunk_size;
+        data += chunk_size;
+        size -= chunk_size;
+    }
+
+    return !writer->error;
+}
+
+int writer_finish(Writer* writer) {
+    if (writer->compress == WRITER_COMPRESS_NONE) {
+        if (fflush(writer->fp) != 0) {
+            writer->error = 1;
+        }
+
+        return !writer->error;
+    }
+
+    if (!writer_flush_blocks(writer)) {
+        return 0;
+    }
+
+    if (!writer->header_written) {
+        writer->header_written = writer_put(writer, s_gzip_header, sizeof(s_gzip_header));
+    }
+
+    const unsigned char trailer[] = {
+        writer->crc & 0xff,
+        (writer->crc >> 8) & 0xff,
+        (writer->crc >> 16) & 0xff,
+        (writer->crc >> 24) & 0xff,
+        writer->size & 0xff,
+        (writer->size >> 8) & 0xff,
+        (writer->size >> 16) & 0xff,
+        (writer->size >> 24) & 0xff,
+    };
+
+    writer_put(writer, s_deflate_trailer, sizeof(s_deflate_trailer));
+    writer_put(writer, trailer, sizeof(trailer));
+
+    if (fflush(writer->fp) != 0) {
+        writer->error = 1;
+    }
+
+    return !writer->error;
+}
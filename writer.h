@@ -0,0 +1,44 @@
+/*
+ * Copyright (C) 2017  Alex Yatskov <alex@foosoft.net>
+ * Author: Alex Yatskov <alex@foosoft.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef WRITER_H
+#define WRITER_H
+
+#include <stdio.h>
+
+/*
+ * Types
+ */
+
+typedef enum {
+    WRITER_COMPRESS_NONE,
+    WRITER_COMPRESS_GZIP,
+} Writer_Compress;
+
+typedef struct Writer Writer;
+
+/*
+ * Functions
+ */
+
+Writer* writer_create(FILE* fp, Writer_Compress compress, int threads);
+void writer_destroy(Writer* writer);
+int writer_write(Writer* writer, const char data[], size_t size);
+int writer_finish(Writer* writer);
+
+#endif /* WRITER_H */